@@ -154,6 +154,7 @@ void LeoChannelConstructor::handleMessage(cMessage *msg)
         updateChannels();
     }
     else if(msg == startManagerNode){
+        configurator->setAddressPlan(addressBase, netmask);
         setUpSimulation();
         setUpGSLinks();
         const bool userTerminalLinksChanged = refreshUserTerminalLinks(true);
@@ -169,12 +170,14 @@ void LeoChannelConstructor::handleMessage(cMessage *msg)
 
         configurator->fillNextHopInterfaceMap();
 
+        // Endpoint attachments must be known before the first routes are computed
+        configurator->setGroundStationsWithEndpoints();
+
+        configurator->setUpdateInterval(updateInterval);
         configurator->updateForwardingStates(simTime());
 
         configurator->setIpv4NodeIds();
 
-        configurator->setGroundStationsWithEndpoints();
-
         scheduleUpdate(true);
     }
     else{
@@ -1067,7 +1070,7 @@ void LeoChannelConstructor::updatePPPModules(cModule *mod, bool addToGraph)
             module->callInitialize();  //error here - trying to initisalise already existing module.
 
             NetworkInterface* ie = dynamic_cast<NetworkInterface*>(mod->getSubmodule("ppp", i));
-            setUpIpLayer(module, ie);
+            setUpIpLayer(mod, ie);
             //std::cout << "\n GATE IN NODE: " << srcGateOut->getPathEndGate()->getOwner()->getOwner()->getOwner()->getFullName() << endl;
             //std::cout << "\n GATE OUT NODE: " << mod->getFullName() << endl;
 
@@ -1087,10 +1090,10 @@ void LeoChannelConstructor::updatePPPModules(cModule *mod, bool addToGraph)
     }
 }
 
-void LeoChannelConstructor::setUpIpLayer(cModule* module, NetworkInterface* interface)
+void LeoChannelConstructor::setUpIpLayer(cModule* node, NetworkInterface* interface)
 {
-    Ipv4Address address = Ipv4Address(addressBase.getInt() + uint32_t(module->getId()));
-    //configurator->assignNewAddress(module);
+    // The node graph ID is encoded in the address, so routers decode it without a lookup
+    Ipv4Address address = configurator->getInterfaceAddress(node, interface->getIndex());
 
     prepareInterface(interface);
     Ipv4InterfaceData *interfaceData = interface->getProtocolDataForUpdate<Ipv4InterfaceData>();
@@ -104,7 +104,7 @@ protected:
     std::unordered_set<cModule *> dirtyPppModules;
 
     void updatePPPModules(cModule *mod, bool addToGraph);
-    void setUpIpLayer(cModule* module, NetworkInterface* interface);
+    void setUpIpLayer(cModule* node, NetworkInterface* interface);
     std::pair<cGate*,cGate*> getNextFreeGate(cModule *mod);
     void setUpInterfaces();
     void cacheNetworkModules();
@@ -87,6 +87,14 @@ double NoradA::getInclination()
     return orbit->Inclination();
 }
 
+/**
+ * Get the orbital period of a node in seconds, from the mean motion recovered by the orbit model.
+ */
+double NoradA::getOrbitalPeriod()
+{
+    return orbit->Period();
+}
+
 /**
  * Primary method that is used to check whether, given the index of a satellite, whether it is compatible as an inter-
  * satellite link. It starts by checking whether the satellite is a part of the same plane, and if it is whether or not
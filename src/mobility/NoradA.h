@@ -39,6 +39,9 @@ public:
 
     double getRaan();
     double getInclination();
+    // Orbital period in seconds. The shell maps onto itself, shifted by one
+    // slot per plane, every getOrbitalPeriod() / getSatellitesPerPlane().
+    double getOrbitalPeriod();
 
     const int getSatelliteNumber(){return satelliteIndex;};
     const int getNumberOfPlanes(){return planes;}
@@ -0,0 +1,294 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#include "LeoContractionHierarchy.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace inet {
+
+namespace {
+
+typedef std::pair<double, int> HeapEntry;
+
+// Witness searches give up after settling this many vertices and add the
+// shortcut instead, which keeps the hierarchy correct but slightly larger
+const int WITNESS_SETTLE_LIMIT = 64;
+
+void pushHeap(std::vector<HeapEntry>& heap, double distance, int vertex)
+{
+    heap.emplace_back(distance, vertex);
+    std::push_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+}
+
+HeapEntry popHeap(std::vector<HeapEntry>& heap)
+{
+    std::pop_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+    HeapEntry entry = heap.back();
+    heap.pop_back();
+    return entry;
+}
+
+}
+
+void LeoContractionHierarchy::clear()
+{
+    rank.clear();
+    upward.clear();
+    numShortcuts = 0;
+}
+
+void LeoContractionHierarchy::build(const LeoRoutingGraph& graph)
+{
+    const int numVertices = graph.getNumVertices();
+    std::vector<std::vector<Arc>> adjacency(numVertices);
+    for (int vertex = 0; vertex < numVertices; vertex++) {
+        for (const LeoRoutingGraph::Arc *arc = graph.arcsBegin(vertex); arc != graph.arcsEnd(vertex); ++arc) {
+            if (arc->target != vertex)
+                addArc(adjacency, vertex, arc->target, arc->weight, -1);
+        }
+    }
+    for (int side = 0; side < 2; side++) {
+        distance[side].assign(numVertices, LEO_UNREACHABLE);
+        parent[side].assign(numVertices, -1);
+        parentMiddle[side].assign(numVertices, -1);
+        heap[side].clear();
+    }
+    touched.clear();
+    contracted.assign(numVertices, 0);
+    rank.assign(numVertices, -1);
+    numShortcuts = 0;
+
+    // Edge difference plus the number of contracted neighbours, which spreads
+    // the contraction evenly over the constellation
+    std::vector<int> contractedNeighbours(numVertices, 0);
+    auto priority = [&](int vertex) {
+        int degree = 0;
+        for (const Arc& arc : adjacency[vertex])
+            degree += !contracted[arc.target];
+        return contractVertex(adjacency, vertex, true) - degree + contractedNeighbours[vertex];
+    };
+
+    std::vector<std::pair<int, int>> queue;
+    for (int vertex = 0; vertex < numVertices; vertex++)
+        queue.emplace_back(priority(vertex), vertex);
+    std::make_heap(queue.begin(), queue.end(), std::greater<std::pair<int, int>>());
+    int nextRank = 0;
+    while (!queue.empty()) {
+        std::pop_heap(queue.begin(), queue.end(), std::greater<std::pair<int, int>>());
+        const int vertex = queue.back().second;
+        queue.pop_back();
+        // lazy update: priorities only grow, so re-queue the vertex if it is no longer the minimum
+        const int current = priority(vertex);
+        if (!queue.empty() && current > queue.front().first) {
+            queue.emplace_back(current, vertex);
+            std::push_heap(queue.begin(), queue.end(), std::greater<std::pair<int, int>>());
+            continue;
+        }
+        numShortcuts += contractVertex(adjacency, vertex, false);
+        contracted[vertex] = 1;
+        rank[vertex] = nextRank++;
+        for (const Arc& arc : adjacency[vertex])
+            contractedNeighbours[arc.target]++;
+    }
+
+    upward.assign(numVertices, std::vector<Arc>());
+    for (int vertex = 0; vertex < numVertices; vertex++) {
+        for (const Arc& arc : adjacency[vertex]) {
+            if (rank[arc.target] > rank[vertex])
+                upward[vertex].push_back(arc);
+        }
+    }
+    contracted.clear();
+}
+
+void LeoContractionHierarchy::addArc(std::vector<std::vector<Arc>>& adjacency, int from, int to, double weight, int middle)
+{
+    for (Arc& arc : adjacency[from]) {
+        if (arc.target == to) {
+            if (weight < arc.weight) {
+                arc.weight = weight;
+                arc.middle = middle;
+            }
+            return;
+        }
+    }
+    adjacency[from].push_back({to, weight, middle});
+}
+
+int LeoContractionHierarchy::contractVertex(std::vector<std::vector<Arc>>& adjacency, int vertex, bool simulate)
+{
+    std::vector<std::pair<int, double>> neighbours;
+    for (const Arc& arc : adjacency[vertex]) {
+        if (!contracted[arc.target])
+            neighbours.emplace_back(arc.target, arc.weight);
+    }
+
+    // One witness search per neighbour covers all pairs it starts
+    int shortcuts = 0;
+    for (size_t i = 0; i + 1 < neighbours.size(); i++) {
+        double limit = 0;
+        for (size_t j = i + 1; j < neighbours.size(); j++)
+            limit = std::max(limit, neighbours[i].second + neighbours[j].second);
+        const int from = neighbours[i].first;
+        searchWitnesses(adjacency, from, vertex, limit);
+        for (size_t j = i + 1; j < neighbours.size(); j++) {
+            const int to = neighbours[j].first;
+            const double viaVertex = neighbours[i].second + neighbours[j].second;
+            if (distance[0][to] <= viaVertex)
+                continue;
+            shortcuts++;
+            if (!simulate) {
+                addArc(adjacency, from, to, viaVertex, vertex);
+                addArc(adjacency, to, from, viaVertex, vertex);
+            }
+        }
+        resetSearch();
+    }
+    return shortcuts;
+}
+
+void LeoContractionHierarchy::searchWitnesses(const std::vector<std::vector<Arc>>& adjacency, int from, int excluded, double limit)
+{
+    // Leaves the distances of the search in distance[0] until resetSearch()
+    std::vector<double>& witnessDistance = distance[0];
+    std::vector<HeapEntry>& witnessHeap = heap[0];
+    witnessHeap.clear();
+    witnessDistance[from] = 0;
+    touched.push_back(from);
+    pushHeap(witnessHeap, 0, from);
+    int settled = 0;
+    while (!witnessHeap.empty() && settled < WITNESS_SETTLE_LIMIT) {
+        const HeapEntry entry = popHeap(witnessHeap);
+        const int vertex = entry.second;
+        if (entry.first > witnessDistance[vertex])
+            continue;
+        if (entry.first > limit)
+            break;
+        settled++;
+        for (const Arc& arc : adjacency[vertex]) {
+            if (arc.target == excluded || contracted[arc.target])
+                continue;
+            const double candidate = entry.first + arc.weight;
+            if (candidate < witnessDistance[arc.target]) {
+                if (witnessDistance[arc.target] == LEO_UNREACHABLE)
+                    touched.push_back(arc.target);
+                witnessDistance[arc.target] = candidate;
+                pushHeap(witnessHeap, candidate, arc.target);
+            }
+        }
+    }
+}
+
+void LeoContractionHierarchy::resetSearch()
+{
+    for (int vertex : touched) {
+        for (int side = 0; side < 2; side++) {
+            distance[side][vertex] = LEO_UNREACHABLE;
+            parent[side][vertex] = -1;
+            parentMiddle[side][vertex] = -1;
+        }
+    }
+    touched.clear();
+    heap[0].clear();
+    heap[1].clear();
+}
+
+double LeoContractionHierarchy::query(int source, int target, std::vector<int>& path)
+{
+    path.clear();
+    if (source == target) {
+        path.push_back(source);
+        return 0;
+    }
+
+    // Bidirectional Dijkstra that only follows arcs upwards in the hierarchy.
+    // Edges are undirected, so both searches use the same upward arcs.
+    const int roots[2] = {source, target};
+    for (int side = 0; side < 2; side++) {
+        distance[side][roots[side]] = 0;
+        touched.push_back(roots[side]);
+        pushHeap(heap[side], 0, roots[side]);
+    }
+    double best = LEO_UNREACHABLE;
+    int meeting = -1;
+    while (!heap[0].empty() || !heap[1].empty()) {
+        for (int side = 0; side < 2; side++) {
+            if (heap[side].empty())
+                continue;
+            if (heap[side].front().first >= best) {
+                heap[side].clear();
+                continue;
+            }
+            const HeapEntry entry = popHeap(heap[side]);
+            const int vertex = entry.second;
+            if (entry.first > distance[side][vertex])
+                continue;
+            if (entry.first + distance[1 - side][vertex] < best) {
+                best = entry.first + distance[1 - side][vertex];
+                meeting = vertex;
+            }
+            for (const Arc& arc : upward[vertex]) {
+                const double candidate = entry.first + arc.weight;
+                if (candidate < distance[side][arc.target]) {
+                    touched.push_back(arc.target);
+                    distance[side][arc.target] = candidate;
+                    parent[side][arc.target] = vertex;
+                    parentMiddle[side][arc.target] = arc.middle;
+                    pushHeap(heap[side], candidate, arc.target);
+                }
+            }
+        }
+    }
+
+    if (meeting >= 0) {
+        std::vector<int> forward;
+        for (int vertex = meeting; vertex != source; vertex = parent[0][vertex])
+            forward.push_back(vertex);
+        path.push_back(source);
+        for (auto it = forward.rbegin(); it != forward.rend(); ++it)
+            unpackArc(parent[0][*it], *it, parentMiddle[0][*it], path);
+        for (int vertex = meeting; vertex != target; vertex = parent[1][vertex])
+            unpackArc(vertex, parent[1][vertex], parentMiddle[1][vertex], path);
+    }
+    resetSearch();
+    return best;
+}
+
+const LeoContractionHierarchy::Arc *LeoContractionHierarchy::findUpwardArc(int from, int to) const
+{
+    for (const Arc& arc : upward[from]) {
+        if (arc.target == to)
+            return &arc;
+    }
+    return nullptr;
+}
+
+void LeoContractionHierarchy::unpackArc(int from, int to, int middle, std::vector<int>& path) const
+{
+    // Appends the vertices after from up to and including to. Both halves of a
+    // shortcut are upward arcs of the bypassed vertex, which has the lower rank.
+    if (middle < 0) {
+        path.push_back(to);
+        return;
+    }
+    const Arc *first = findUpwardArc(middle, from);
+    const Arc *second = findUpwardArc(middle, to);
+    unpackArc(from, middle, first->middle, path);
+    unpackArc(middle, to, second->middle, path);
+}
+
+} // namespace inet
@@ -0,0 +1,78 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef NETWORKLAYER_CONFIGURATOR_IPV4_LEOCONTRACTIONHIERARCHY_H_
+#define NETWORKLAYER_CONFIGURATOR_IPV4_LEOCONTRACTIONHIERARCHY_H_
+
+#include <utility>
+#include <vector>
+
+#include "LeoRoutingGraph.h"
+
+namespace inet {
+
+//-----------------------------------------------------
+// Class: LeoContractionHierarchy
+//
+// Contraction hierarchy over one LeoRoutingGraph snapshot. Vertices are
+// contracted in the order of their edge difference and shortcuts are added
+// where no witness path exists, so a query only has to run two small upward
+// searches instead of a Dijkstra over the whole constellation. Building takes
+// much longer than one query and pays off when many point-to-point routes are
+// needed within the same routing interval.
+//-----------------------------------------------------
+class LeoContractionHierarchy
+{
+  public:
+    void build(const LeoRoutingGraph& graph);
+    void clear();
+    bool isValid() const { return !rank.empty(); }
+
+    // Fills path with the vertices from source to target and returns the path
+    // cost, or infinity (and an empty path) if target is not reachable.
+    double query(int source, int target, std::vector<int>& path);
+
+    int getNumShortcuts() const { return numShortcuts; }
+
+  protected:
+    struct Arc {
+        int target;
+        double weight;
+        int middle; // contracted vertex the shortcut bypasses, -1 for graph edges
+    };
+
+    void addArc(std::vector<std::vector<Arc>>& adjacency, int from, int to, double weight, int middle);
+    int contractVertex(std::vector<std::vector<Arc>>& adjacency, int vertex, bool simulate);
+    void searchWitnesses(const std::vector<std::vector<Arc>>& adjacency, int from, int excluded, double limit);
+    const Arc *findUpwardArc(int from, int to) const;
+    void unpackArc(int from, int to, int middle, std::vector<int>& path) const;
+    void resetSearch();
+
+    std::vector<int> rank;
+    std::vector<std::vector<Arc>> upward; // arcs towards higher ranked vertices
+    std::vector<char> contracted;
+    int numShortcuts = 0;
+
+    // search buffers, index 0 forward and 1 backward
+    std::vector<double> distance[2];
+    std::vector<int> parent[2];
+    std::vector<int> parentMiddle[2];
+    std::vector<int> touched;
+    std::vector<std::pair<double, int>> heap[2];
+};
+
+} // namespace inet
+
+#endif /* NETWORKLAYER_CONFIGURATOR_IPV4_LEOCONTRACTIONHIERARCHY_H_ */
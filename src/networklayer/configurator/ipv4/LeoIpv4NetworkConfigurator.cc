@@ -16,16 +16,40 @@
 #include <sstream>
 #include<iostream>
 #include <filesystem>
+#include <fstream>
+#include <map>
+#include <cstring>
+#include <inet/queueing/contract/IPacketCollection.h>
 #include "LeoIpv4NetworkConfigurator.h"
+#include "LeoRoutingThreads.h"
+#include "../../../libnorad/cEcef.h"
 
 namespace inet {
 Define_Module(LeoIpv4NetworkConfigurator);
 
 namespace {
 
+// Version 2 route files, a flat list of (node, destination, next hop) records, can still be
+// loaded. They only hold rank 1 routes; files with ranked next hops are written as version 3.
 constexpr int32_t ROUTE_FILE_MAGIC = 0x4c454f32;   // "LEO2"
 constexpr int32_t ROUTE_FILE_VERSION = 2;
 
+// The destination field of a route record (see installRouteRecords) carries the next-hop rank (k - 1) in its top byte
+constexpr int ROUTE_RANK_SHIFT = 24;
+constexpr int32_t ROUTE_DESTINATION_MASK = (1 << ROUTE_RANK_SHIFT) - 1;
+
+// The next-hop field of a record flags alternatives whose path cost is within ecmpCostSlack of rank 1
+constexpr int32_t ROUTE_EQUAL_COST_FLAG = LeoRouteState::EQUAL_COST_FLAG;
+
+// Link weights are at least the straight line delay in ms; the A* heuristic keeps
+// a margin for the difference between the ECEF positions and the orbit model
+constexpr double ROUTE_QUERY_MS_PER_METRE = 0.99 * 1000 / 299792458.0;
+
+// ISL weights of symmetric intervals only differ by the rounding of the orbit model
+constexpr double SYMMETRY_WEIGHT_TOLERANCE = 1e-6; // ms
+// Fastest change of an ISL delay: two satellites at LEO speed moving apart
+constexpr double SYMMETRY_MAX_DELAY_RATE = 2 * 8000.0 / 299792458.0; // s per s
+
 }
 
 static void silent_warning_handler(const char *reason, const char *file, int line) {
@@ -39,9 +63,9 @@ static bool isEndpointTypeName(const std::string& typeName)
 
 LeoIpv4NetworkConfigurator::~LeoIpv4NetworkConfigurator()
 {
+    cancelAndDelete(failureTimer);
     nodeModules.clear();
     ipv4Modules.clear();
-    nextHopInterfaceMatrix.clear();
     igraph_vector_int_destroy(&islVec);
 }
 
@@ -78,10 +102,80 @@ void LeoIpv4NetworkConfigurator::initialize(int stage)
         // Assign unique IDs to modules (custom method)
         assignIDtoModules();
         ipv4Modules.resize(nodeModules.size(), nullptr);
-        nextHopInterfaceMatrix.assign(nodeModules.size(), std::vector<int>(nodeModules.size(), -1));
+        neighbourInterfaces.reset(nodeModules.size());
 
         // Path calculation parameters
-        numOfKPaths = par("numOfKPaths");
+        numOfNextHops = par("numOfNextHops");
+        numRoutingThreads = par("numRoutingThreads");
+        incrementalRouting = par("incrementalRouting");
+        destinationRootedRouting = par("destinationRootedRouting");
+        lazyRouting = par("lazyRouting");
+        prefetchRoutes = par("prefetchRoutes");
+        routeFileCompression = par("routeFileCompression");
+        if (routeFileCompression < 0 || routeFileCompression > 9)
+            throw cRuntimeError("routeFileCompression must be a zlib level from 0 to 9");
+        routeKeyframeSpacing = par("routeKeyframeSpacing");
+        if (routeKeyframeSpacing < 1)
+            throw cRuntimeError("routeKeyframeSpacing must be at least 1");
+        if (lazyRouting && loadFiles)
+            throw cRuntimeError("lazyRouting computes routes when packets need them, it needs loadFiles = false");
+        lazyRoutedVector.setName("lazyRoutedDestinations");
+        routeQueryHierarchy = par("routeQueryHierarchy");
+        routeQueryLatencyVector.setName("routeQueryLatency");
+        routeDriftThreshold = par("routeDriftThreshold").doubleValueInUnit("ms");
+        weightDriftVector.setName("routeWeightDrift");
+        edgeDisjointKPaths = par("edgeDisjointKPaths");
+        if (numOfNextHops < 1 || numOfNextHops > (1 << (31 - ROUTE_RANK_SHIFT)))
+            throw cRuntimeError("numOfNextHops must be between 1 and %d", 1 << (31 - ROUTE_RANK_SHIFT));
+        if (edgeDisjointKPaths && numOfNextHops != 2)
+            throw cRuntimeError("edgeDisjointKPaths requires numOfNextHops = 2");
+        std::string linkWeightMode = par("linkWeightMode").stdstringValue();
+        if (linkWeightMode != "delay" && linkWeightMode != "congestion")
+            throw cRuntimeError("Unknown linkWeightMode '%s', expected 'delay' or 'congestion'", linkWeightMode.c_str());
+        congestionWeights = linkWeightMode == "congestion";
+        congestionDamping = par("congestionDamping");
+        if (congestionDamping < 0 || congestionDamping >= 1)
+            throw cRuntimeError("congestionDamping must be in [0, 1)");
+        if (congestionWeights && loadFiles)
+            throw cRuntimeError("linkWeightMode = \"congestion\" needs the routes to be computed during the run, set loadFiles = false");
+        queueingDelayVector.setName("meanQueueingDelay");
+        failedNodes.assign(nodeModules.size(), 0);
+        parseFailureSchedule(par("failureSchedule"));
+        if (!failureEvents.empty()) {
+            failureTimer = new cMessage("failure");
+            scheduleAt(failureEvents.front().time, failureTimer);
+        }
+        ecmpCostSlack = par("ecmpCostSlack");
+        if (ecmpCostSlack < 0)
+            throw cRuntimeError("ecmpCostSlack must not be negative");
+        std::string forwardingTableType = par("forwardingTableType").stdstringValue();
+        if (forwardingTableType != "dense" && forwardingTableType != "ranges")
+            throw cRuntimeError("Unknown forwardingTableType '%s', expected 'dense' or 'ranges'", forwardingTableType.c_str());
+        rangeForwardingTables = forwardingTableType == "ranges";
+        sourceRouting = par("sourceRouting");
+        forwardingArena.allocate(rangeForwardingTables || sourceRouting ? 0 : numOfSats + numOfGS, numOfSats + numOfGS, numOfNextHops);
+        inFlightWindow = par("inFlightWindow");
+        if (sourceRouting && (loadFiles || inFlightWindow > 0))
+            throw cRuntimeError("sourceRouting computes paths during the run from the current topology, it needs loadFiles = false and inFlightWindow = 0");
+        if (sourceRouting && numOfSats + numOfGS > 65535)
+            throw cRuntimeError("sourceRouting writes hops as 16-bit node numbers, it supports at most 65535 satellites and ground stations");
+        lazyRouteLoading = par("lazyRouteLoading");
+        if (lazyRouteLoading && (!loadFiles || inFlightWindow > 0))
+            throw cRuntimeError("lazyRouteLoading installs the routes of a node from the route archive on its first lookup, it needs loadFiles = true and inFlightWindow = 0");
+        if (sourceRouting)
+            sourceRouteTrees.resize(numOfSats + numOfGS);
+        if (!loadFiles && !sourceRouting)
+            routeState.reset(numOfSats + numOfGS, numOfNextHops, numOfSats + numOfGS);
+        symmetryRouteReuse = par("symmetryRouteReuse");
+        if (symmetryRouteReuse && (loadFiles || sourceRouting || lazyRouting || incrementalRouting || destinationRootedRouting || numOfNextHops > 1))
+            throw cRuntimeError("symmetryRouteReuse computes single path routes towards all nodes during the run, it cannot be combined with "
+                                "loadFiles, sourceRouting, lazyRouting, incrementalRouting, destinationRootedRouting or numOfNextHops > 1");
+        if (symmetryRouteReuse && (satPerPlane == 0 || numOfSats % satPerPlane != 0 || numOfSats >= NO_SYMMETRIC_NEXT_HOP))
+            throw cRuntimeError("symmetryRouteReuse needs full planes of satsPerPlane satellites and fewer than %d satellites", NO_SYMMETRIC_NEXT_HOP);
+        if (inFlightWindow > 0)
+            previousForwardingArena.allocate(rangeForwardingTables ? 0 : numOfSats + numOfGS, numOfSats + numOfGS, numOfNextHops);
+        scannedVerticesVector.setName("repairScannedVertices");
+        scannedArcsVector.setName("repairScannedArcs");
         currentInterval = 0;
 
         // Read orbit characteristics
@@ -127,15 +221,96 @@ void LeoIpv4NetworkConfigurator::initialize(int stage)
 
         verifyModuleIDMappingsFromFile(configLocation + filePrefix + "/idMap.txt");
 
+        if (loadFiles) {
+            std::string archiveName = configLocation + filePrefix + "/" + LEO_ROUTE_ARCHIVE_NAME;
+            if (std::filesystem::is_regular_file(archiveName) && !routeArchive.open(archiveName))
+                throw cRuntimeError("Corrupt route archive %s", archiveName.c_str());
+            if (lazyRouteLoading && routeArchive.isOpen()) {
+                for (size_t e = 0; e < routeArchive.getNumIntervals(); e++) {
+                    if (routeArchive.getEntries()[e].rawSize != 0)
+                        throw cRuntimeError("lazyRouteLoading decodes single nodes from the mapped route archive, %s must be written with routeFileCompression = 0", archiveName.c_str());
+                }
+                routeBlocks.resize(routeArchive.getNumIntervals());
+            }
+        }
+
         updateModuleIDMappingsClientServer();
 
         igraph_vector_int_init(&islVec, 0);
     }
 }
 
+void LeoIpv4NetworkConfigurator::finish()
+{
+    if (!loadFiles) {
+        flushRouteFile();
+        if (!routeArchiveWriter.close())
+            throw cRuntimeError("Cannot write the index of route archive %s/%s", filePrefix.c_str(), LEO_ROUTE_ARCHIVE_NAME);
+    }
+    else {
+        routePrefetcher.wait();
+        if (routeArchive.isOpen() && lazyRouteLoading)
+            recordScalar("materializedRouteTables", materializedRouteTables);
+        else if (routeArchive.isOpen()) {
+            recordScalar("prefetchedRouteLoads", prefetchedRouteLoads);
+            recordScalar("deltaRouteLoads", deltaRouteLoads);
+        }
+    }
+    recordScalar("forwardingTableBytes", peakForwardingTableBytes);
+    recordScalar("denseForwardingTableBytes", denseForwardingTableBytes);
+    if (!loadFiles)
+        recordScalar("skippedRouteComputations", skippedRecomputations);
+    if (lazyRouting)
+        recordScalar("lazyRoutedDestinations", totalLazyRoutedDestinations);
+    if (symmetryRouteReuse)
+        recordScalar("symmetricRouteReuses", symmetricRouteReuses);
+    if (numRouteQueries > 0) {
+        recordScalar("routeQueries", numRouteQueries);
+        recordScalar("meanRouteQueryLatency", totalRouteQueryLatency / numRouteQueries);
+        if (routeQueryHierarchy)
+            recordScalar("contractionHierarchyBuildTime", totalHierarchyBuildTime);
+    }
+    if (incrementalRouting && totalTreeUpdates > 0) {
+        recordScalar("incrementalTreeUpdates", totalTreeUpdates);
+        recordScalar("scannedVerticesPerTreeUpdate", (double)totalScannedVertices / totalTreeUpdates);
+        recordScalar("scannedArcsPerTreeUpdate", (double)totalScannedArcs / totalTreeUpdates);
+    }
+}
 
 bool LeoIpv4NetworkConfigurator::loadConfiguration(simtime_t currentInterval)
 {
+    if (routeArchive.isOpen()) {
+        const LeoRouteArchiveEntry *entry = routeArchive.find(currentInterval.raw());
+        if (entry == nullptr)
+            return false;
+        if (lazyRouteLoading) {
+            loadRouteEntries(entry - routeArchive.getEntries());
+            return true;
+        }
+        std::string archiveName = filePrefix + "/" + LEO_ROUTE_ARCHIVE_NAME;
+        std::string error;
+        if (!routePrefetcher.take(entry->interval, loadedRoutes, error)) {
+            if (!error.empty())
+                throw cRuntimeError("Cannot prefetch the routes of %s from %s: %s", currentInterval.str().c_str(), archiveName.c_str(), error.c_str());
+            // walks the entries since the interval loaded before, which a coarser
+            // updateInterval than the one of the archive skips
+            if (!routeArchive.decodeRoutes(entry->interval, loadedRoutes, routeFileBuffer, error))
+                throw cRuntimeError("Cannot load the routes of %s from %s: %s", currentInterval.str().c_str(), archiveName.c_str(), error.c_str());
+        }
+        else
+            prefetchedRouteLoads++;
+        installDecodedRoutes(archiveName);
+        // Decode the interval the next update asks for while this one runs. The
+        // first update comes 1us late and the archive may have been written with
+        // a finer updateInterval, so it is the first entry from then on.
+        if (prefetchRoutes && updateInterval > 0) {
+            if (const LeoRouteArchiveEntry *next = routeArchive.findFrom((currentInterval + updateInterval).raw()))
+                routePrefetcher.prefetch(routeArchive, next->interval);
+        }
+        return true;
+    }
+
+    // Route files of single intervals, as written before the archive existed
     std::string fName = configLocation + filePrefix + "/" + currentInterval.str() + ".bin";
 
     if (!std::filesystem::is_regular_file(fName))
@@ -145,22 +320,23 @@ bool LeoIpv4NetworkConfigurator::loadConfiguration(simtime_t currentInterval)
     if (!file.is_open())
         return false;
 
-    const int routableNodeCount = std::min(static_cast<int>(numOfSats + numOfGS), static_cast<int>(nodeModules.size()));
-    for (int nodeId = 0; nodeId < routableNodeCount; nodeId++) {
-        LeoIpv4 *ipv4Mod = ipv4Modules[nodeId];
-        if (ipv4Mod == nullptr) {
-            cModule *nodeMod = nodeModules[nodeId];
-            ipv4Mod = nodeMod != nullptr ? dynamic_cast<LeoIpv4 *>(nodeMod->getModuleByPath(".ipv4.ip")) : nullptr;
-            ipv4Modules[nodeId] = ipv4Mod;
-        }
-        if (ipv4Mod != nullptr)
-            ipv4Mod->clearNextHops();
-    }
-
     int32_t firstValue = 0;
     file.read(reinterpret_cast<char *>(&firstValue), sizeof(firstValue));
     if (file.fail())
         return false;
+    if (firstValue == LEO_ROUTE_FILE_MAGIC) {
+        file.seekg(0, std::ios::end);
+        routeFileBuffer.resize(file.tellg());
+        file.seekg(0, std::ios::beg);
+        file.read(reinterpret_cast<char *>(routeFileBuffer.data()), routeFileBuffer.size());
+        if (file.fail())
+            return false;
+        return applyRouteFile(routeFileBuffer.data(), routeFileBuffer.size(), fName);
+    }
+
+    clearForwardingTables();
+    loadedRoutes.interval = LEO_ROUTE_KEYFRAME;
+    installedRouteInterval = LEO_ROUTE_KEYFRAME;
 
     bool usesStableNextHopNodeFormat = false;
     if (firstValue == ROUTE_FILE_MAGIC) {
@@ -170,6 +346,9 @@ bool LeoIpv4NetworkConfigurator::loadConfiguration(simtime_t currentInterval)
             return false;
         if (version != ROUTE_FILE_VERSION)
             throw cRuntimeError("Unsupported route file version %d in %s", version, fName.c_str());
+        if (numOfNextHops > 1)
+            throw cRuntimeError("Version 2 route file %s has no next-hop ranks and cannot be loaded with numOfNextHops > 1, "
+                                "regenerate it with loadFiles = false", fName.c_str());
         usesStableNextHopNodeFormat = true;
     }
     else {
@@ -198,28 +377,22 @@ bool LeoIpv4NetworkConfigurator::loadConfiguration(simtime_t currentInterval)
         if (nodeId < 0 || nodeId >= static_cast<int>(ipv4Modules.size()))
             continue;
 
-        LeoIpv4 *ipv4Mod = ipv4Modules[nodeId];
-        if (ipv4Mod == nullptr) {
-            cModule *nodeMod = nodeModules[nodeId];
-            ipv4Mod = dynamic_cast<LeoIpv4*>(nodeMod->getModuleByPath(".ipv4.ip"));
-            if (!ipv4Mod)
-                continue;
-            ipv4Modules[nodeId] = ipv4Mod;
-        }
+        LeoIpv4 *ipv4Mod = getIpv4Module(nodeId);
+        if (!ipv4Mod)
+            continue;
 
         int nextHopId = nextHopToken;
         if (usesStableNextHopNodeFormat) {
-            if (nextHopToken < 0 || nextHopToken >= static_cast<int>(nextHopInterfaceMatrix[nodeId].size()))
+            if (nextHopToken < 0 || nextHopToken >= neighbourInterfaces.getNumNodes())
                 throw cRuntimeError("Invalid next-hop node %d for source node %d in %s",
                                     nextHopToken, nodeId, fName.c_str());
-            nextHopId = nextHopInterfaceMatrix[nodeId][nextHopToken];
+            nextHopId = neighbourInterfaces.getInterfaceId(nodeId, nextHopToken);
             if (nextHopId <= 0)
                 throw cRuntimeError("Failed to resolve current interface for source node %d via next-hop node %d in %s",
                                     nodeId, nextHopToken, fName.c_str());
         }
 
         ipv4Mod->addKNextHop(1, destAddr, nextHopId);
-        ipv4Mod->addNextHop(destAddr, nextHopId);
     }
     file.close();
     return true;
@@ -238,6 +411,18 @@ void LeoIpv4NetworkConfigurator::assignIDtoModules()
 
 void LeoIpv4NetworkConfigurator::updateForwardingStates(simtime_t currentInterval)
 {
+    if (!loadFiles) {
+        flushRouteFile();
+        collectTopologyEdges(topologyEdgeEndpoints, topologyEdgeWeights);
+        if (!needsRecomputation()) {
+            reuseRoutes(currentInterval);
+            return;
+        }
+    }
+    if (inFlightWindow > 0)
+        rotateForwardingTables();
+    routingEpoch++;
+    routingEpochStart = simTime();
     if(loadFiles){
         bool completedLoad = loadConfiguration(currentInterval);
         if(!completedLoad){
@@ -247,7 +432,163 @@ void LeoIpv4NetworkConfigurator::updateForwardingStates(simtime_t currentInterva
     else{
         generateTopologyGraph(currentInterval);
     }
+    invalidateForwardingDecisions();
+    reportForwardingTableMemory();
+}
+
+bool LeoIpv4NetworkConfigurator::needsRecomputation()
+{
+    // Routes only change if a link appeared or disappeared, or if the weights moved
+    // enough to reorder paths. The link set is compared by a hash over the edge
+    // list, whose order is fixed for a given set (ISLs first, then ground links).
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (int endpoint : topologyEdgeEndpoints) {
+        hash ^= (uint32_t)endpoint;
+        hash *= 1099511628211ULL;
+    }
+    const bool sameLinkSet = routedEdgeWeights.size() == topologyEdgeWeights.size() && hash == routedLinkSetHash;
+    double maxDrift = 0;
+    if (sameLinkSet) {
+        for (size_t i = 0; i < topologyEdgeWeights.size(); i++)
+            maxDrift = std::max(maxDrift, std::abs(topologyEdgeWeights[i] - routedEdgeWeights[i]));
+        weightDriftVector.record(maxDrift);
+        if (maxDrift <= routeDriftThreshold)
+            return false;
+    }
+    routedLinkSetHash = hash;
+    routedEdgeWeights = topologyEdgeWeights;
+    return true;
+}
 
+void LeoIpv4NetworkConfigurator::reuseRoutes(simtime_t currentInterval)
+{
+    // The installed tables stay valid, so neither the epochs nor the cached
+    // decisions change; the route file of the interval holds no changes
+    skippedRecomputations++;
+    EV_INFO << "Topology unchanged within " << routeDriftThreshold << "ms, keeping the routes of the last computation" << endl;
+    if (!routeState.isEmpty()) {
+        routeFilePending = true;
+        pendingRouteInterval = currentInterval;
+    }
+}
+
+void LeoIpv4NetworkConfigurator::rotateForwardingTables()
+{
+    // Keep the tables of the ending epoch for the packets still in flight under it
+    for (int nodeNum = 0; nodeNum < numOfSats+numOfGS; nodeNum++)
+        getIpv4Module(nodeNum);
+    std::swap(forwardingArena, previousForwardingArena);
+    for (int nodeNum = 0; nodeNum < numOfSats+numOfGS; nodeNum++) {
+        if (LeoIpv4 *ipv4Mod = ipv4Modules[nodeNum])
+            ipv4Mod->rotateForwardingTables(rangeForwardingTables ? nullptr : forwardingArena.getTableEntries(nodeNum));
+    }
+    // and the interfaces they were built with, the links may have moved since
+    std::swap(epochNeighbourInterfaces, previousNeighbourInterfaces);
+    epochNeighbourInterfaces = neighbourInterfaces;
+}
+
+bool LeoIpv4NetworkConfigurator::getSourceRoute(int nodeNum, int destinationNodeNum, std::vector<int>& path)
+{
+    // Paths follow the shortest path tree of the destination, computed the first
+    // time any ingress node routes towards it in the current interval
+    path.clear();
+    if (destinationNodeNum < 0 || destinationNodeNum >= (int)sourceRouteTrees.size() || nodeNum < 0 || nodeNum >= routingGraph.getNumVertices())
+        return false;
+    LeoShortestPathTree& tree = sourceRouteTrees[destinationNodeNum];
+    if (!tree.isValid())
+        computeShortestPathTree(routingGraph, destinationNodeNum, tree, sourceRouteScratch);
+    if (tree.parent[nodeNum] < 0)
+        return false;
+    for (int hop = tree.parent[nodeNum]; hop >= 0; hop = tree.parent[hop]) {
+        path.push_back(hop);
+        if (hop == destinationNodeNum)
+            break;
+    }
+    return true;
+}
+
+void LeoIpv4NetworkConfigurator::prepareRouteQueries()
+{
+    // Positions are taken together with the link weights so that the A* heuristic
+    // never overestimates; without them A* degrades to Dijkstra
+    contractionHierarchy.clear();
+    const int routableNodeCount = numOfSats + numOfGS;
+    nodePositions.assign(routableNodeCount, LeoVertexPosition{0, 0, 0});
+    routeQueryHeuristicScale = ROUTE_QUERY_MS_PER_METRE;
+    for (int nodeNum = 0; nodeNum < routableNodeCount; nodeNum++) {
+        cModule *mobility = getNodeModule(nodeNum)->getSubmodule("mobility");
+        cEcef position;
+        if (SatelliteMobility *satMobility = dynamic_cast<SatelliteMobility*>(mobility))
+            position = cEcef(satMobility->getLatitude(), satMobility->getLongitude(), satMobility->getAltitude());
+        else if (GroundStationMobility *gsMobility = dynamic_cast<GroundStationMobility*>(mobility))
+            position = cEcef(gsMobility->getLUTPositionY(), gsMobility->getLUTPositionX(), 0);
+        else {
+            routeQueryHeuristicScale = 0;
+            return;
+        }
+        nodePositions[nodeNum] = {position.getX(), position.getY(), position.getZ()};
+    }
+}
+
+double LeoIpv4NetworkConfigurator::queryRoute(int sourceNodeNum, int destinationNodeNum, simtime_t t, std::vector<int>& path)
+{
+    if (routingGraph.getNumVertices() == 0)
+        throw cRuntimeError("Route queries need the topology graph, set loadFiles = false");
+    if (t < routingEpochStart || t > simTime())
+        throw cRuntimeError("Route query at %s is outside of the current routing interval [%s, %s]",
+                            t.str().c_str(), routingEpochStart.str().c_str(), simTime().str().c_str());
+    if (sourceNodeNum < 0 || sourceNodeNum >= routingGraph.getNumVertices() || destinationNodeNum < 0 || destinationNodeNum >= routingGraph.getNumVertices())
+        throw cRuntimeError("Route query from node %d to node %d, only satellites and ground stations are routable", sourceNodeNum, destinationNodeNum);
+
+    auto start = std::chrono::steady_clock::now();
+    if (routeQueryHierarchy && !contractionHierarchy.isValid()) {
+        contractionHierarchy.build(routingGraph);
+        auto built = std::chrono::steady_clock::now();
+        const double buildTime = std::chrono::duration<double, std::micro>(built - start).count();
+        totalHierarchyBuildTime += buildTime;
+        EV_INFO << "Built contraction hierarchy with " << contractionHierarchy.getNumShortcuts() << " shortcuts in " << buildTime << "us" << endl;
+        start = built;
+    }
+    double delay;
+    if (routeQueryHierarchy)
+        delay = contractionHierarchy.query(sourceNodeNum, destinationNodeNum, path);
+    else
+        delay = computeAStarPath(routingGraph, sourceNodeNum, destinationNodeNum, nodePositions, routeQueryHeuristicScale, routeQueryScratch, path);
+    const double latency = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    routeQueryLatencyVector.record(latency);
+    totalRouteQueryLatency += latency;
+    numRouteQueries++;
+    return delay;
+}
+
+void LeoIpv4NetworkConfigurator::clearForwardingTables()
+{
+    invalidateForwardingDecisions();
+    if (!rangeForwardingTables) {
+        forwardingArena.clear();
+        return;
+    }
+    for (int nodeNum = 0; nodeNum < numOfSats+numOfGS; nodeNum++) {
+        if (LeoIpv4 *ipv4Mod = getIpv4Module(nodeNum))
+            ipv4Mod->clearNextHops();
+    }
+}
+
+void LeoIpv4NetworkConfigurator::reportForwardingTableMemory()
+{
+    size_t bytes = rangeForwardingTables ? 0 : forwardingArena.getMemoryUsage() + previousForwardingArena.getMemoryUsage();
+    size_t denseBytes = 0;
+    for (int nodeNum = 0; nodeNum < numOfSats+numOfGS; nodeNum++) {
+        if (LeoIpv4 *ipv4Mod = ipv4Modules[nodeNum]) {
+            const LeoForwardingTable& table = ipv4Mod->getForwardingTable();
+            if (rangeForwardingTables)
+                bytes += table.getMemoryUsage() + (inFlightWindow > 0 ? ipv4Mod->getPreviousForwardingTable().getMemoryUsage() : 0);
+            denseBytes += table.getDenseMemoryUsage();
+        }
+    }
+    peakForwardingTableBytes = std::max(peakForwardingTableBytes, bytes);
+    denseForwardingTableBytes = denseBytes;
+    EV_INFO << "Forwarding tables use " << bytes << " bytes (" << (denseBytes > 0 ? 100.0 * bytes / denseBytes : 0.0) << "% of the dense table)" << endl;
 }
 
 void LeoIpv4NetworkConfigurator::clearGroundStationLinks()
@@ -278,7 +619,7 @@ void LeoIpv4NetworkConfigurator::establishInitialISLs()
                 igraph_vector_int_push_back(&islVec, destSatNumA);
 
                 SatelliteMobility* destSatMobility = dynamic_cast<SatelliteMobility*>(destModA->getModuleByPath(".mobility"));
-                satelliteISLMobilityModules[sourceSatMobility].push_back(destSatMobility);
+                islMobilityPairs.emplace_back(sourceSatMobility, destSatMobility);
 
                 islVecIterator = islVecIterator + 2;
 //                for(int i = 0; i < satMod->gateSize("pppg$o"); i++){  //check each possible pppg gate
@@ -292,7 +633,7 @@ void LeoIpv4NetworkConfigurator::establishInitialISLs()
 //                            double distance = 0;
 //                            if(mobilityName == "leosatellites.mobility.SatelliteMobility"){
 //                                SatelliteMobility* destSatMobility = dynamic_cast<SatelliteMobility*>(destModA->getModuleByPath(".mobility"));
-//                                satelliteISLMobilityModules[sourceSatMobility].push_back(destSatMobility);
+//                                islMobilityPairs.emplace_back(sourceSatMobility, destSatMobility);
 //                            }
 //                        }
 //                    }
@@ -306,7 +647,7 @@ void LeoIpv4NetworkConfigurator::establishInitialISLs()
                 igraph_vector_int_push_back(&islVec, destSatNumB);
 
                 SatelliteMobility* destSatMobility = dynamic_cast<SatelliteMobility*>(destModB->getModuleByPath(".mobility"));
-                satelliteISLMobilityModules[sourceSatMobility].push_back(destSatMobility);
+                islMobilityPairs.emplace_back(sourceSatMobility, destSatMobility);
 
                 //islVecIterator = islVecIterator + 2;
 //                for(int i = 0; i < satMod->gateSize("pppg$o"); i++){  //check each possible pppg gate
@@ -319,7 +660,7 @@ void LeoIpv4NetworkConfigurator::establishInitialISLs()
 //                            double distance = 0;
 //                            if(mobilityName == "leosatellites.mobility.SatelliteMobility"){
 //                                SatelliteMobility* destSatMobility = dynamic_cast<SatelliteMobility*>(destModB->getModuleByPath(".mobility"));
-//                                satelliteISLMobilityModules[sourceSatMobility].push_back(destSatMobility);
+//                                islMobilityPairs.emplace_back(sourceSatMobility, destSatMobility);
 //                            }
 //                        }
 //                    }
@@ -331,181 +672,777 @@ void LeoIpv4NetworkConfigurator::establishInitialISLs()
 
 void LeoIpv4NetworkConfigurator::generateTopologyGraph(simtime_t currentInterval)
 {
-    if (!std::filesystem::is_directory(filePrefix) || !std::filesystem::exists(filePrefix)) {
-        std::filesystem::create_directory(filePrefix);
+    if (sourceRouting) {
+        // No tables to fill, the ingress nodes ask for paths on the new graph
+        routingGraph.build(numOfSats + numOfGS, topologyEdgeEndpoints, topologyEdgeWeights);
+        prepareRouteQueries();
+        for (LeoShortestPathTree& tree : sourceRouteTrees)
+            tree.order.clear();
+        return;
+    }
+    // The routes installed below are collected in routeState and written by
+    // flushRouteFile() when the interval is over, routes added on demand included
+    routeState.clear();
+    routeFilePending = true;
+    pendingRouteInterval = currentInterval;
+
+    clearForwardingTables();
+    for (int nodeNum = 0; nodeNum < numOfSats+numOfGS; nodeNum++)
+        getIpv4Module(nodeNum);
+
+    // collected by updateForwardingStates()
+    const std::vector<int>& edgeEndpoints = topologyEdgeEndpoints;
+    const std::vector<double>& edgeWeights = topologyEdgeWeights;
+    if (incrementalRouting)
+        std::swap(previousRoutingGraph, routingGraph);
+    routingGraph.build(numOfSats + numOfGS, edgeEndpoints, edgeWeights);
+    if (incrementalRouting) {
+        diffRoutingGraphs(previousRoutingGraph, routingGraph, routingGraphChanges);
+        routingGraphVersion++;
     }
-    std::ofstream fout;
-    std::string fName = filePrefix + "/" + currentInterval.str() + ".bin";
-    fout.open(fName, std::ios::binary | std::ios::trunc);
-    const int32_t magic = ROUTE_FILE_MAGIC;
-    const int32_t version = ROUTE_FILE_VERSION;
-    fout.write(reinterpret_cast<const char *>(&magic), sizeof(magic));
-    fout.write(reinterpret_cast<const char *>(&version), sizeof(version));
+    prepareRouteQueries();
 
-    for (int nodeNum = 0; nodeNum < numOfSats+numOfGS; nodeNum++) {
-        LeoIpv4 *ipv4Mod = ipv4Modules[nodeNum];
-        if (ipv4Mod == nullptr) {
-            cModule* mod = nodeModules[nodeNum];
-            ipv4Mod = dynamic_cast<LeoIpv4 *>(mod->getModuleByPath(".ipv4.ip"));
-            ipv4Modules[nodeNum] = ipv4Mod;
-        }
-        if (ipv4Mod != nullptr)
-            ipv4Mod->clearNextHops();
+    if (symmetryRouteReuse && prepareSymmetricRoutes()) {
+        computeSymmetricRoutes(edgeEndpoints, edgeWeights);
+        return;
+    }
+    if (lazyRouting || destinationRootedRouting || numOfNextHops > 1) {
+        computeDestinationRoutes(edgeEndpoints, edgeWeights);
+        return;
     }
+    if (incrementalRouting) {
+        computeIncrementalRoutes(edgeEndpoints, edgeWeights);
+        return;
+    }
+
+    // igraph's error and finally stacks are only per thread if it was built with
+    // thread-local storage, which stock builds are not; worker threads therefore
+    // run the Dijkstra of LeoRoutingGraph and igraph stays the single-threaded
+    // reference implementation
+    const int routableNodeCount = numOfSats + numOfGS;
+    const int numThreads = resolveRoutingThreadCount(numRoutingThreads, routableNodeCount);
+    if (numThreads > 1) {
+        computeSourceRoutes(numThreads);
+        return;
+    }
+
     igraph_t constellationTopology;
-    igraph_vector_int_t shortestPathVertexVec, shortestPathEdgesVec;
     igraph_vector_int_t islVecCopy;
-    igraph_vector_int_init_copy(&islVecCopy, &islVec);
-    //std::cout << "\nOG ISL VEC SIZE: " << igraph_vector_int_size(&islVec) << endl;
+    igraph_vector_int_init(&islVecCopy, edgeEndpoints.size());
+    for (size_t i = 0; i < edgeEndpoints.size(); i++)
+        VECTOR(islVecCopy)[i] = edgeEndpoints[i];
     igraph_vector_t weightsVec;
-    igraph_vector_init(&weightsVec, 0);
-    unsigned int islVecIterator = 0;
-    unsigned int weightsVecIterator = 0;
-    for (auto iter = satelliteISLMobilityModules.begin(); iter != satelliteISLMobilityModules.end(); ++iter) {
-        std::vector<SatelliteMobility*> mobVec = iter->second;
-        for (SatelliteMobility* iter2 : mobVec) {
-            //if(iter->first != iter2){
-                //std::cout << "\nSOURCE SAT: " << iter->first->getParentModule()->getFullName() << "\nDEST SAT: " << iter2->getParentModule()->getFullName();
-                double distance = iter->first->getDistance(iter2->getLatitude(), iter2->getLongitude(), iter2->getAltitude())*1000;
-                double weight = (distance/299792458)*1000;
-                //VECTOR(weightsVec)[weightsVecIterator] = weight;
-                igraph_vector_push_back(&weightsVec, weight);
-                weightsVecIterator++;
-                islVecIterator = islVecIterator + 2;
-            //}
+    igraph_vector_view(&weightsVec, edgeWeights.data(), edgeWeights.size());
+
+    igraph_empty(&constellationTopology, numOfSats+numOfGS, IGRAPH_UNDIRECTED);
+
+    igraph_add_edges(&constellationTopology, &islVecCopy, 0);
+
+    igraph_vector_int_list_t vertexPaths;
+    igraph_vector_int_list_t edgePaths;
+    igraph_vector_int_t nrgeo;
+    igraph_vector_int_list_init(&vertexPaths, 0);
+    igraph_vector_int_list_init(&edgePaths, 0);
+    igraph_vector_int_init(&nrgeo, 0);
+    std::vector<int32_t> records;
+    for (int sourceNodeNum = 0; sourceNodeNum < routableNodeCount; sourceNodeNum++) {
+        records.clear();
+        igraph_get_all_shortest_paths_dijkstra(&constellationTopology, &vertexPaths, &edgePaths, /*nrgeo=*/ &nrgeo, /*from=*/ sourceNodeNum, /*to=*/ igraph_vss_all(), /*weights=*/ &weightsVec, /*mode=*/ IGRAPH_ALL);
+        for (igraph_integer_t i = 0; i < igraph_vector_int_list_size(&vertexPaths); i++) {
+            igraph_vector_int_t *path = igraph_vector_int_list_get_ptr(&vertexPaths, i);
+            int pathSourceNum = igraph_vector_int_get(path, 0);
+            int destinationNodeNum = igraph_vector_int_get(path, igraph_vector_int_size(path)-1);
+            if(pathSourceNum != destinationNodeNum){
+                records.push_back(pathSourceNum);
+                records.push_back(destinationNodeNum);
+                records.push_back(igraph_vector_int_get(path, 1));
+            }
         }
+        igraph_vector_int_list_clear(&vertexPaths);
+        igraph_vector_int_list_clear(&edgePaths);
+        installRouteRecords(records);
+    }
+
+    igraph_vector_int_list_destroy(&vertexPaths);
+    igraph_vector_int_list_destroy(&edgePaths);
+    igraph_vector_int_destroy(&nrgeo);
+    igraph_destroy(&constellationTopology);
+    igraph_vector_int_destroy(&islVecCopy);
+}
+
+void LeoIpv4NetworkConfigurator::computeSourceRoutes(int numThreads)
+{
+    // Every source is independent, so the Dijkstra runs on routingGraph are spread
+    // over worker threads. The records are installed and written in source order,
+    // so the route file does not depend on the number of threads.
+    const int routableNodeCount = numOfSats + numOfGS;
+    std::vector<LeoDijkstraScratch> scratch(numThreads);
+    std::vector<LeoShortestPathTree> trees(numThreads);
+    std::vector<std::vector<int>> firstHops(numThreads);
+
+    // Sources are processed in blocks to bound the memory held by pending records
+    const int blockSize = numThreads * 64;
+    std::vector<std::vector<int32_t>> sourceRecords(blockSize);
+    for (int blockStart = 0; blockStart < routableNodeCount; blockStart += blockSize) {
+        const int blockEnd = std::min(blockStart + blockSize, routableNodeCount);
+        parallelForEach(blockStart, blockEnd, numThreads, [&](int sourceNodeNum, int worker) {
+            computeShortestPathTree(routingGraph, sourceNodeNum, trees[worker], scratch[worker]);
+            std::vector<int>& firstHop = firstHops[worker];
+            computeFirstHops(trees[worker], sourceNodeNum, firstHop);
+            std::vector<int32_t>& records = sourceRecords[sourceNodeNum - blockStart];
+            records.clear();
+            for (int destinationNodeNum = 0; destinationNodeNum < routableNodeCount; destinationNodeNum++) {
+                if (firstHop[destinationNodeNum] < 0)
+                    continue;
+                records.push_back(sourceNodeNum);
+                records.push_back(destinationNodeNum);
+                records.push_back(firstHop[destinationNodeNum]);
+            }
+        });
+
+        for (int sourceNodeNum = blockStart; sourceNodeNum < blockEnd; sourceNodeNum++)
+            installRouteRecords(sourceRecords[sourceNodeNum - blockStart]);
+    }
+}
+
+void LeoIpv4NetworkConfigurator::collectTopologyEdges(std::vector<int>& edgeEndpoints, std::vector<double>& edgeWeights)
+{
+    // ISLs first, in islVec order, followed by the ground links queued for this interval
+    const int numOfIslEdges = islMobilityPairs.size();
+    edgeEndpoints.assign(VECTOR(islVec), VECTOR(islVec) + 2 * numOfIslEdges);
+    edgeWeights.clear();
+    edgeWeights.reserve(numOfIslEdges + groundStationLinks.size());
+    for (const auto& islPair : islMobilityPairs) {
+        SatelliteMobility *destSatMobility = islPair.second;
+        double distance = islPair.first->getDistance(destSatMobility->getLatitude(), destSatMobility->getLongitude(), destSatMobility->getAltitude())*1000;
+        edgeWeights.push_back((distance/299792458)*1000);
     }
-    int numberOfGSLinks = groundStationLinks.size();
-    for(int i = 0; i < numberOfGSLinks; i++){ //TODO USE ATTRIBUTE NAMES TO
-        std::tuple<int, int, double> gsTup = groundStationLinks.front();
+    while (!groundStationLinks.empty()) {
+        const std::tuple<int, int, double>& gsTup = groundStationLinks.front();
+        edgeEndpoints.push_back(std::get<0>(gsTup));
+        edgeEndpoints.push_back(std::get<1>(gsTup));
+        edgeWeights.push_back(std::get<2>(gsTup));
         groundStationLinks.pop();
-        igraph_vector_int_push_back(&islVecCopy, std::get<0>(gsTup)); // @suppress("Function cannot be instantiated")
-        igraph_vector_int_push_back(&islVecCopy, std::get<1>(gsTup));
-        //VECTOR(weightsVec)[weightsVecIterator] = std::get<2>(gsTup);
-        igraph_vector_push_back(&weightsVec, std::get<2>(gsTup));
-        islVecIterator = islVecIterator + 2;
-        weightsVecIterator++;
     }
+    if (!failedLinks.empty() || std::find(failedNodes.begin(), failedNodes.end(), 1) != failedNodes.end())
+        removeFailedEdges(edgeEndpoints, edgeWeights);
+    if (congestionWeights)
+        addQueueingDelays(edgeEndpoints, edgeWeights);
+}
 
-    igraph_empty(&constellationTopology, numOfSats+numOfGS, IGRAPH_UNDIRECTED);
+void LeoIpv4NetworkConfigurator::removeFailedEdges(std::vector<int>& edgeEndpoints, std::vector<double>& edgeWeights)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < edgeWeights.size(); i++) {
+        const int a = edgeEndpoints[2 * i];
+        const int b = edgeEndpoints[2 * i + 1];
+        if (failedNodes[a] || failedNodes[b] || failedLinks.count(((uint64_t)a << 32) | (uint32_t)b))
+            continue;
+        edgeEndpoints[2 * kept] = a;
+        edgeEndpoints[2 * kept + 1] = b;
+        edgeWeights[kept++] = edgeWeights[i];
+    }
+    edgeEndpoints.resize(2 * kept);
+    edgeWeights.resize(kept);
+}
 
-    igraph_add_edges(&constellationTopology, &islVecCopy, 0);
+void LeoIpv4NetworkConfigurator::addQueueingDelays(const std::vector<int>& edgeEndpoints, std::vector<double>& edgeWeights)
+{
+    // Each link gets the queueing delay of its busier direction, smoothed over the
+    // intervals so that traffic moved away from a link does not immediately pull it back
+    std::unordered_map<uint64_t, double> estimates;
+    estimates.reserve(edgeWeights.size() * 2);
+    double totalDelay = 0;
+    for (size_t i = 0; i < edgeWeights.size(); i++) {
+        double linkDelay = 0;
+        for (int direction = 0; direction < 2; direction++) {
+            const int node = edgeEndpoints[2 * i + direction];
+            const int neighbour = edgeEndpoints[2 * i + 1 - direction];
+            const uint64_t key = ((uint64_t)node << 32) | (uint32_t)neighbour;
+            double estimate = getQueueingDelay(node, neighbour);
+            auto it = queueingDelayEstimates.find(key);
+            if (it != queueingDelayEstimates.end())
+                estimate = congestionDamping * it->second + (1 - congestionDamping) * estimate;
+            estimates[key] = estimate;
+            linkDelay = std::max(linkDelay, estimate);
+        }
+        edgeWeights[i] += linkDelay;
+        totalDelay += linkDelay;
+    }
+    // links that disappeared start over when they come back
+    queueingDelayEstimates.swap(estimates);
+    if (!edgeWeights.empty())
+        queueingDelayVector.record(totalDelay / edgeWeights.size());
+}
+
+double LeoIpv4NetworkConfigurator::getQueueingDelay(int node, int neighbour)
+{
+    // Time in milliseconds to drain the queue of the interface from node towards neighbour
+    const int interfaceId = neighbourInterfaces.getInterfaceId(node, neighbour);
+    if (interfaceId <= 0 || nodeModules[node] == nullptr)
+        return 0;
+    IInterfaceTable *ift = check_and_cast<IInterfaceTable *>(nodeModules[node]->getSubmodule("interfaceTable"));
+    NetworkInterface *networkInterface = ift->getInterfaceById(interfaceId);
+    if (networkInterface == nullptr || networkInterface->getDatarate() <= 0)
+        return 0;
+    auto queue = dynamic_cast<queueing::IPacketCollection *>(networkInterface->getSubmodule("queue"));
+    if (queue == nullptr)
+        return 0;
+    return queue->getTotalLength().get() / networkInterface->getDatarate() * 1000;
+}
 
-    igraph_vector_int_init(&shortestPathVertexVec, 1);
-    igraph_vector_int_init(&shortestPathEdgesVec, 1);
+void LeoIpv4NetworkConfigurator::computeIncrementalRoutes(const std::vector<int>& edgeEndpoints, const std::vector<double>& edgeWeights)
+{
+    // The shortest path tree of every source is kept from the previous interval and
+    // only repaired where the new edge weights or the changed ground links require it.
+    const int routableNodeCount = numOfSats + numOfGS;
+    routingTrees.resize(routableNodeCount);
+    routingTreeVersions.resize(routableNodeCount, -1);
+
+    const int numThreads = resolveRoutingThreadCount(numRoutingThreads, routableNodeCount);
+    std::vector<LeoDijkstraScratch> scratch(numThreads);
+    std::vector<std::vector<int>> firstHops(numThreads);
+
+    const int blockSize = numThreads * 64;
+    std::vector<std::vector<int32_t>> sourceRecords(blockSize);
+    std::vector<LeoTreeRepairCount> sourceCounts(blockSize);
+    LeoTreeRepairCount count;
+    for (int blockStart = 0; blockStart < routableNodeCount; blockStart += blockSize) {
+        const int blockEnd = std::min(blockStart + blockSize, routableNodeCount);
+        parallelForEach(blockStart, blockEnd, numThreads, [&](int sourceNodeNum, int worker) {
+            LeoShortestPathTree& tree = routingTrees[sourceNodeNum];
+            sourceCounts[sourceNodeNum - blockStart] = updateRoutingTree(sourceNodeNum, scratch[worker]);
+
+            std::vector<int>& firstHop = firstHops[worker];
+            computeFirstHops(tree, sourceNodeNum, firstHop);
+            std::vector<int32_t>& records = sourceRecords[sourceNodeNum - blockStart];
+            records.clear();
+            for (int destinationNodeNum = 0; destinationNodeNum < routableNodeCount; destinationNodeNum++) {
+                if (firstHop[destinationNodeNum] < 0)
+                    continue;
+                records.push_back(sourceNodeNum);
+                records.push_back(destinationNodeNum);
+                records.push_back(firstHop[destinationNodeNum]);
+            }
+        });
 
-    igraph_vector_int_list_t vertexPaths;
-    igraph_vector_int_list_t edgePaths;
+        for (int sourceNodeNum = blockStart; sourceNodeNum < blockEnd; sourceNodeNum++) {
+            count.scannedVertices += sourceCounts[sourceNodeNum - blockStart].scannedVertices;
+            count.scannedArcs += sourceCounts[sourceNodeNum - blockStart].scannedArcs;
+            installRouteRecords(sourceRecords[sourceNodeNum - blockStart]);
+        }
+    }
+
+    const long treeVertices = (long)routableNodeCount * routableNodeCount;
+    totalScannedVertices += count.scannedVertices;
+    totalScannedArcs += count.scannedArcs;
+    totalTreeUpdates += routableNodeCount;
+    scannedVerticesVector.record(count.scannedVertices);
+    scannedArcsVector.record(count.scannedArcs);
+    EV_INFO << "Incremental routing scanned " << count.scannedVertices << " of " << treeVertices << " tree vertices ("
+            << (treeVertices > 0 ? 100.0 * count.scannedVertices / treeVertices : 0.0) << "%) and "
+            << count.scannedArcs << " arcs for " << routingGraphChanges.size() << " changed edges" << endl;
+}
+
+LeoTreeRepairCount LeoIpv4NetworkConfigurator::updateRoutingTree(int root, LeoDijkstraScratch& scratch)
+{
+    // The edge changes only lead from the previous graph, a tree that skipped
+    // an interval (e.g. a destination that was not routed lazily) is recomputed
+    LeoShortestPathTree& tree = routingTrees[root];
+    if (routingTreeVersions[root] == routingGraphVersion)
+        return LeoTreeRepairCount();
+    if (routingTreeVersions[root] != routingGraphVersion - 1)
+        tree.order.clear();
+    routingTreeVersions[root] = routingGraphVersion;
+    return repairShortestPathTree(routingGraph, root, routingGraphChanges, tree, scratch);
+}
+
+void LeoIpv4NetworkConfigurator::computeDestinationRoutes(const std::vector<int>& edgeEndpoints, const std::vector<double>& edgeWeights)
+{
+    // Links are symmetric, so the parent of a node in the tree rooted at a destination
+    // is that node's next hop towards the destination. The same tree also ranks the
+    // alternative next hops when numOfNextHops > 1. In destination rooted mode only the
+    // ground stations and nodes with attached endpoints are destinations, since
+    // traffic only terminates there. In lazy mode there are none up front, each
+    // destination is routed when the first packet towards it misses.
+    const int routableNodeCount = numOfSats + numOfGS;
+    routedDestinations.assign(routableNodeCount, 0);
+    if (lazyRouting && lazyRoutedDestinations > 0) {
+        lazyRoutedVector.record(lazyRoutedDestinations);
+        lazyRoutedDestinations = 0;
+    }
 
-    igraph_vector_int_list_init(&vertexPaths, 1);
-    igraph_vector_int_list_init(&edgePaths, 1);
-
-    if(numOfKPaths <= 1){
-        int fmDuration = 0;
-        int rDuration = 0;
-        for(int sourceNodeNum = 0; sourceNodeNum < numOfSats+numOfGS; sourceNodeNum++){
-            igraph_get_all_shortest_paths_dijkstra(&constellationTopology, &vertexPaths, &edgePaths, /*nrgeo=*/ &shortestPathVertexVec, /*from=*/ sourceNodeNum, /*to=*/ igraph_vss_all(), /*weights=*/ &weightsVec, /*mode=*/ IGRAPH_ALL);
-            cModule *sourceMod = nodeModules[sourceNodeNum];
-            LeoIpv4* srcIpv4Mod = ipv4Modules[sourceNodeNum];
-            if (srcIpv4Mod == nullptr) {
-                srcIpv4Mod = dynamic_cast<LeoIpv4 *>(sourceMod->getModuleByPath(".ipv4.ip"));
-                ipv4Modules[sourceNodeNum] = srcIpv4Mod;
+    std::vector<int> destinations;
+    for (int nodeNum = 0; nodeNum < routableNodeCount && !lazyRouting; nodeNum++) {
+        if (!destinationRootedRouting || getNodeTypeCode(nodeNum) == 1 || getTotalEndpoints(nodeNum) > 0)
+            destinations.push_back(nodeNum);
+    }
+    computeDestinationTrees(destinations);
+    EV_INFO << "Computed routes towards " << destinations.size() << " of " << routableNodeCount << " nodes" << endl;
+}
+
+void LeoIpv4NetworkConfigurator::computeSymmetricRoutes(const std::vector<int>& edgeEndpoints, const std::vector<double>& edgeWeights)
+{
+    // Satellite destinations are routed over the ISLs only, which the shell shift
+    // maps onto themselves; ground stations attach to the path of their cheapest
+    // satellite. Routes towards ground stations are computed on the full graph.
+    const int numSats = numOfSats;
+    const int routableNodeCount = numOfSats + numOfGS;
+    routedDestinations.assign(routableNodeCount, 0);
+
+    std::vector<int> islEndpoints;
+    std::vector<double> islWeights;
+    for (size_t i = 0; i < edgeWeights.size(); i++) {
+        if (edgeEndpoints[2 * i] < numSats && edgeEndpoints[2 * i + 1] < numSats) {
+            islEndpoints.push_back(edgeEndpoints[2 * i]);
+            islEndpoints.push_back(edgeEndpoints[2 * i + 1]);
+            islWeights.push_back(edgeWeights[i]);
+        }
+    }
+    LeoRoutingGraph satelliteGraph;
+    satelliteGraph.build(numSats, islEndpoints, islWeights);
+
+    // A failed satellite or ISL breaks the symmetry, such intervals are neither reused nor kept
+    const bool symmetric = failedLinks.empty() && std::find(failedNodes.begin(), failedNodes.end(), 1) == failedNodes.end();
+    int shift = 0;
+    const SymmetryPhase *phase = symmetric ? findSymmetricPhase(satelliteGraph, shift) : nullptr;
+    symmetricNextHops.resize((size_t)numSats * numSats);
+    if (phase != nullptr) {
+        // next hop now (u, d) = shift back the next hop then (u + shift, d + shift)
+        for (int destinationNodeNum = 0; destinationNodeNum < numSats; destinationNodeNum++) {
+            const uint16_t *row = &phase->nextHops[(size_t)shiftSatellite(destinationNodeNum, shift) * numSats];
+            uint16_t *shiftedRow = &symmetricNextHops[(size_t)destinationNodeNum * numSats];
+            for (int nodeNum = 0; nodeNum < numSats; nodeNum++) {
+                const uint16_t nextHop = row[shiftSatellite(nodeNum, shift)];
+                shiftedRow[nodeNum] = nextHop != NO_SYMMETRIC_NEXT_HOP ? shiftSatellite(nextHop, satPerPlane - shift) : NO_SYMMETRIC_NEXT_HOP;
             }
-            igraph_vector_int_t *path;
-            for (int i = 0; i < igraph_vector_int_list_size(&vertexPaths); i++) {
-                path = igraph_vector_int_list_get_ptr(&vertexPaths, i);
-                int sourceNodeNum = igraph_vector_int_get(path, 0);
-                int nextHopNodeNum = igraph_vector_int_get(path, 1);
-                int destinationNodeNum = igraph_vector_int_get(path, igraph_vector_int_size(path)-1);
-                if(sourceNodeNum != destinationNodeNum){
-                    int nextHopID = nextHopInterfaceMatrix[sourceNodeNum][nextHopNodeNum];
-//                    IInterfaceTable* destIft = dynamic_cast<IInterfaceTable*>(destMod->getSubmodule("interfaceTable"));
-//                    int totalInterfaces = 0;
-//                    for (size_t j = 0; j < destIft->getNumInterfaces(); j++) {
-//                        NetworkInterface *destinationIE = destIft->getInterface(j);
-//                        if (!destinationIE->isLoopback()){
-////                            srcIpv4Mod->addNextHop(destinationIE->getIpv4Address().getInt(),nextHopID);
-////                            std::string str1 = destMod->getFullName();
-////                            std::string str2 = nextHopMod->getFullName() + std::to_string(nextHopID);
-////                            //str2 = str2 + std::string(nextHopID);
-////                            srcIpv4Mod->addNextHopStr(str1, str2);
-////                            //srcIpv4Mod->addKNextHop(1, destinationIE->getIpv4Address().getInt(), nextHopID);
-////                            int32_t src = sourceNodeNum;
-////                            int32_t dst = destinationIE->getIpv4Address().getInt();
-////                            int32_t nhop = nextHopID;
-//                        }
-//                        else{
-//                            totalInterfaces = totalInterfaces + 1;
-//                        }
-//                    }
-                    srcIpv4Mod->addKNextHop(1, destinationNodeNum, nextHopID);
-                    fout.write(reinterpret_cast<const char*>(&sourceNodeNum), sizeof(int32_t));
-                    fout.write(reinterpret_cast<const char*>(&destinationNodeNum), sizeof(int32_t));
-                    fout.write(reinterpret_cast<const char*>(&nextHopNodeNum), sizeof(int32_t));
+        }
+        symmetricRouteReuses++;
+        EV_INFO << "Reused the satellite routes of " << phase->time << " shifted by " << shift << " slots" << endl;
+    }
+    else {
+        const int numThreads = resolveRoutingThreadCount(numRoutingThreads, numSats);
+        std::vector<LeoDijkstraScratch> scratch(numThreads);
+        std::vector<LeoShortestPathTree> workerTrees(numThreads);
+        parallelForEach(0, numSats, numThreads, [&](int destinationNodeNum, int worker) {
+            LeoShortestPathTree& tree = workerTrees[worker];
+            computeShortestPathTree(satelliteGraph, destinationNodeNum, tree, scratch[worker]);
+            uint16_t *row = &symmetricNextHops[(size_t)destinationNodeNum * numSats];
+            for (int nodeNum = 0; nodeNum < numSats; nodeNum++)
+                row[nodeNum] = nodeNum != destinationNodeNum && tree.parent[nodeNum] >= 0 ? tree.parent[nodeNum] : NO_SYMMETRIC_NEXT_HOP;
+        });
+        if (symmetric) {
+            // only the intervals the next updates can match are kept
+            while (!symmetryHistory.empty() && symmetryHistory.front().time < simTime() - symmetryLag - symmetryTimeSlack)
+                symmetryHistory.pop_front();
+            symmetryHistory.push_back(SymmetryPhase());
+            symmetryHistory.back().time = simTime();
+            symmetryHistory.back().satelliteGraph = satelliteGraph;
+            symmetryHistory.back().nextHops = symmetricNextHops;
+        }
+    }
+
+    std::vector<int32_t> records;
+    std::vector<double> distance(numSats);
+    std::vector<int> pending;
+    for (int destinationNodeNum = 0; destinationNodeNum < numSats; destinationNodeNum++) {
+        const uint16_t *row = &symmetricNextHops[(size_t)destinationNodeNum * numSats];
+        records.clear();
+        for (int nodeNum = 0; nodeNum < numSats; nodeNum++) {
+            if (row[nodeNum] != NO_SYMMETRIC_NEXT_HOP) {
+                records.push_back(nodeNum);
+                records.push_back(destinationNodeNum);
+                records.push_back(row[nodeNum]);
+            }
+        }
+
+        // Path costs towards the destination with the current weights, filled in on demand (-1 = unknown)
+        std::fill(distance.begin(), distance.end(), -1);
+        distance[destinationNodeNum] = 0;
+        auto pathDistance = [&](int satNum) {
+            for (int u = satNum; distance[u] < 0; u = row[u]) {
+                if (row[u] == NO_SYMMETRIC_NEXT_HOP) {
+                    distance[u] = LEO_UNREACHABLE;
+                    break;
                 }
+                pending.push_back(u);
+            }
+            for (auto it = pending.rbegin(); it != pending.rend(); ++it)
+                distance[*it] = satelliteGraph.getEdgeWeight(*it, row[*it]) + distance[row[*it]];
+            pending.clear();
+            return distance[satNum];
+        };
+        for (int gsNum = numSats; gsNum < routableNodeCount; gsNum++) {
+            double bestDistance = LEO_UNREACHABLE;
+            int bestSatellite = -1;
+            for (const LeoRoutingGraph::Arc *arc = routingGraph.arcsBegin(gsNum); arc != routingGraph.arcsEnd(gsNum); ++arc) {
+                if (arc->target >= numSats)
+                    continue;
+                const double candidate = arc->weight + pathDistance(arc->target);
+                if (candidate < bestDistance) {
+                    bestDistance = candidate;
+                    bestSatellite = arc->target;
+                }
+            }
+            if (bestSatellite >= 0) {
+                records.push_back(gsNum);
+                records.push_back(destinationNodeNum);
+                records.push_back(bestSatellite);
             }
-            igraph_vector_int_destroy(path);
-            igraph_vector_int_list_clear(&vertexPaths);
-            igraph_vector_int_list_clear(&edgePaths);
         }
+        routedDestinations[destinationNodeNum] = 1;
+        installRouteRecords(records);
     }
-    else{
-        for(int sourceNodeNum = 0; sourceNodeNum < numOfSats+numOfGS; sourceNodeNum++){
-            cModule *sourceMod = nodeModules[sourceNodeNum];
-            LeoIpv4* srcIpv4Mod = ipv4Modules[sourceNodeNum];
-            if (srcIpv4Mod == nullptr) {
-                srcIpv4Mod = dynamic_cast<LeoIpv4 *>(sourceMod->getModuleByPath(".ipv4.ip"));
-                ipv4Modules[sourceNodeNum] = srcIpv4Mod;
-            }
-            for(int destNodeNum = 0; destNodeNum <  numOfSats+numOfGS; destNodeNum++){
-                if(sourceNodeNum != destNodeNum){
-                    igraph_get_k_shortest_paths(&constellationTopology, &weightsVec, &vertexPaths, &edgePaths, numOfKPaths, sourceNodeNum, destNodeNum, IGRAPH_ALL);
-                    igraph_vector_int_t *path;
-                    for (int i = 0; i < igraph_vector_int_list_size(&vertexPaths); i++) {
-                        path = igraph_vector_int_list_get_ptr(&vertexPaths, i);
-                        int sourceNodeNum = igraph_vector_int_get(path, 0);
-                        int nextHopNodeNum = igraph_vector_int_get(path, 1);
-                        int destinationNodeNum = igraph_vector_int_get(path, igraph_vector_int_size(path)-1);
-                        if(sourceNodeNum != destinationNodeNum){
-                            int nextHopID = nextHopInterfaceMatrix[sourceNodeNum][nextHopNodeNum];
-//                            IInterfaceTable* destIft = dynamic_cast<IInterfaceTable*>(destMod->getSubmodule("interfaceTable"));
-//                            for (size_t j = 0; j < destIft->getNumInterfaces(); j++) {
-//                                NetworkInterface *destinationIE = destIft->getInterface(j);
-//                                if (!destinationIE->isLoopback()){
-//                                    srcIpv4Mod->addNextHop(destinationIE->getIpv4Address().getInt(),nextHopID);
-//                                    srcIpv4Mod->addKNextHop(i+1, destinationIE->getIpv4Address().getInt(), nextHopID);
-//
-//                                    int32_t src = sourceNodeNum;
-//                                    int32_t dst = destinationIE->getIpv4Address().getInt();
-//                                    int32_t nhop = nextHopID;
-//                                    fout.write(reinterpret_cast<const char*>(&src), sizeof(int32_t));
-//                                    fout.write(reinterpret_cast<const char*>(&dst), sizeof(int32_t));
-//                                    fout.write(reinterpret_cast<const char*>(&nhop), sizeof(int32_t));
-//                                }
-//                            }
-                            srcIpv4Mod->addKNextHop(i+1, destinationNodeNum, nextHopID);
-                            fout.write(reinterpret_cast<const char*>(&sourceNodeNum), sizeof(int32_t));
-                            fout.write(reinterpret_cast<const char*>(&destinationNodeNum), sizeof(int32_t));
-                            fout.write(reinterpret_cast<const char*>(&nextHopNodeNum), sizeof(int32_t));
-                        }
+
+    std::vector<int> groundStations;
+    for (int gsNum = numSats; gsNum < routableNodeCount; gsNum++)
+        groundStations.push_back(gsNum);
+    computeDestinationTrees(groundStations);
+}
+
+bool LeoIpv4NetworkConfigurator::prepareSymmetricRoutes()
+{
+    // Runs before the first routes, once NoradA knows the orbital period. A kept
+    // interval can only match one a whole number of shift periods later, and
+    // that has to be an update time to within the ISL weight tolerance; if no
+    // shift up to a full orbit lines up with updateInterval, reuse never fires
+    // and the history would only cost memory, so routes are computed normally.
+    if (symmetryLag > 0)
+        return true;
+    NoradA *noradModule = dynamic_cast<NoradA*>(getNodeModule(0)->getSubmodule("NoradModule"));
+    if (noradModule == nullptr)
+        throw cRuntimeError("symmetryRouteReuse needs satellites propagated by NoradA");
+    symmetryShiftPeriod = noradModule->getOrbitalPeriod() / satPerPlane;
+    symmetryTimeSlack = std::max(routeDriftThreshold, SYMMETRY_WEIGHT_TOLERANCE) / 1000 / SYMMETRY_MAX_DELAY_RATE;
+    const double interval = updateInterval.dbl();
+    for (int shifts = 1; shifts <= satPerPlane && interval > 0; shifts++) {
+        const double lag = shifts * symmetryShiftPeriod;
+        const double updates = std::round(lag / interval);
+        if (updates >= 1 && std::abs(lag - updates * interval) <= symmetryTimeSlack) {
+            symmetryLag = updates * interval;
+            EV_INFO << "Symmetry reuse matches intervals " << shifts << " shift periods (" << symmetryLag << " s) apart, keeping "
+                    << (long)updates + 1 << " intervals" << endl;
+            return true;
+        }
+    }
+    std::cerr << "WARNING: symmetryRouteReuse is disabled, no multiple of the shift period " << symmetryShiftPeriod
+              << " s up to a full orbit is a multiple of updateInterval " << updateInterval << " to within "
+              << symmetryTimeSlack << " s (raise routeDriftThreshold or pick an updateInterval that divides the shift period)" << endl;
+    symmetryRouteReuse = false;
+    return false;
+}
+
+const LeoIpv4NetworkConfigurator::SymmetryPhase *LeoIpv4NetworkConfigurator::findSymmetricPhase(const LeoRoutingGraph& satelliteGraph, int& shift)
+{
+    // Candidates are the kept intervals a whole number of shift periods ago. The
+    // ISL weights decide: every ISL has to match the shifted ISL of the candidate.
+    const double tolerance = std::max(routeDriftThreshold, SYMMETRY_WEIGHT_TOLERANCE);
+    for (auto phase = symmetryHistory.rbegin(); phase != symmetryHistory.rend(); ++phase) {
+        const long shifts = std::lround((simTime() - phase->time).dbl() / symmetryShiftPeriod);
+        if (shifts <= 0 || phase->satelliteGraph.getNumEdges() != satelliteGraph.getNumEdges())
+            continue;
+        // satellites move towards higher slots, but check the other direction as well
+        for (long candidateShift : {shifts, -shifts}) {
+            const int slots = (int)(((candidateShift % satPerPlane) + satPerPlane) % satPerPlane);
+            bool matches = true;
+            for (int u = 0; u < satelliteGraph.getNumVertices() && matches; u++) {
+                for (const LeoRoutingGraph::Arc *arc = satelliteGraph.arcsBegin(u); arc != satelliteGraph.arcsEnd(u); ++arc) {
+                    const double weight = phase->satelliteGraph.getEdgeWeight(shiftSatellite(u, slots), shiftSatellite(arc->target, slots));
+                    if (!(std::abs(weight - arc->weight) <= tolerance)) {
+                        matches = false;
+                        break;
                     }
-                    igraph_vector_int_destroy(path);
-                    igraph_vector_int_list_clear(&vertexPaths);
-                    igraph_vector_int_list_clear(&edgePaths);
                 }
             }
+            if (matches) {
+                shift = slots;
+                return &*phase;
+            }
         }
     }
-    igraph_vector_int_list_destroy(&vertexPaths);
-    igraph_vector_int_list_destroy(&edgePaths);
+    return nullptr;
+}
 
-    while(!groundStationLinks.empty()) groundStationLinks.pop();
-    igraph_destroy(&constellationTopology);
-    igraph_vector_int_destroy(&islVecCopy);
-    igraph_vector_destroy(&weightsVec);
-    igraph_vector_int_destroy(&shortestPathVertexVec);
-    igraph_vector_int_destroy(&shortestPathEdgesVec);
-    fout.close();
+void LeoIpv4NetworkConfigurator::computeDestinationTrees(const std::vector<int>& destinations)
+{
+    const int routableNodeCount = routingGraph.getNumVertices();
+    const int numThreads = resolveRoutingThreadCount(numRoutingThreads, destinations.size());
+    std::vector<LeoDijkstraScratch> scratch(numThreads);
+    std::vector<LeoShortestPathTree> workerTrees(numThreads);
+    std::vector<std::vector<int>> workerNextHops(numThreads);
+    std::vector<std::vector<char>> workerEqualCost(numThreads);
+    const int k = numOfNextHops;
+    if (incrementalRouting) {
+        routingTrees.resize(routableNodeCount);
+        routingTreeVersions.resize(routableNodeCount, -1);
+    }
+
+    const int blockSize = numThreads * 64;
+    std::vector<std::vector<int32_t>> destinationRecords(blockSize);
+    std::vector<LeoTreeRepairCount> destinationCounts(blockSize);
+    LeoTreeRepairCount count;
+    for (int blockStart = 0; blockStart < (int)destinations.size(); blockStart += blockSize) {
+        const int blockEnd = std::min(blockStart + blockSize, (int)destinations.size());
+        parallelForEach(blockStart, blockEnd, numThreads, [&](int item, int worker) {
+            const int destinationNodeNum = destinations[item];
+            LeoShortestPathTree& tree = incrementalRouting ? routingTrees[destinationNodeNum] : workerTrees[worker];
+            if (incrementalRouting)
+                destinationCounts[item - blockStart] = updateRoutingTree(destinationNodeNum, scratch[worker]);
+            else
+                computeShortestPathTree(routingGraph, destinationNodeNum, tree, scratch[worker]);
+
+            std::vector<int>& nextHops = workerNextHops[worker];
+            std::vector<char>& equalCost = workerEqualCost[worker];
+            computeDestinationNextHops(routingGraph, tree, destinationNodeNum, k, edgeDisjointKPaths, ecmpCostSlack, scratch[worker], nextHops, equalCost);
+
+            std::vector<int32_t>& records = destinationRecords[item - blockStart];
+            records.clear();
+            for (int nodeNum = 0; nodeNum < routableNodeCount; nodeNum++) {
+                for (int rank = 0; rank < k && nextHops[nodeNum * k + rank] >= 0; rank++) {
+                    records.push_back(nodeNum);
+                    records.push_back(destinationNodeNum | (rank << ROUTE_RANK_SHIFT));
+                    records.push_back(nextHops[nodeNum * k + rank] | (equalCost[nodeNum * k + rank] ? ROUTE_EQUAL_COST_FLAG : 0));
+                }
+            }
+        });
+
+        for (int item = blockStart; item < blockEnd; item++) {
+            routedDestinations[destinations[item]] = 1;
+            count.scannedVertices += destinationCounts[item - blockStart].scannedVertices;
+            count.scannedArcs += destinationCounts[item - blockStart].scannedArcs;
+            installRouteRecords(destinationRecords[item - blockStart]);
+        }
+    }
+
+    if (incrementalRouting && !destinations.empty()) {
+        totalScannedVertices += count.scannedVertices;
+        totalScannedArcs += count.scannedArcs;
+        totalTreeUpdates += destinations.size();
+        scannedVerticesVector.record(count.scannedVertices);
+        scannedArcsVector.record(count.scannedArcs);
+    }
+}
+
+void LeoIpv4NetworkConfigurator::ensureDestinationRoutes(int nodeNum)
+{
+    // An endpoint attached to a node that was not a destination at the start of the
+    // interval (e.g. after a user terminal handover); route towards it on the current graph.
+    if (nodeNum < 0 || nodeNum >= (int)routedDestinations.size() || routedDestinations[nodeNum])
+        return;
+    computeDestinationTrees(std::vector<int>(1, nodeNum));
+    invalidateForwardingDecisions();
+}
+
+bool LeoIpv4NetworkConfigurator::routeOnDemand(int destinationNodeNum)
+{
+    if (!lazyRouting || destinationNodeNum < 0 || destinationNodeNum >= (int)routedDestinations.size() || routedDestinations[destinationNodeNum])
+        return false;
+    ensureDestinationRoutes(destinationNodeNum);
+    lazyRoutedDestinations++;
+    totalLazyRoutedDestinations++;
+    return true;
+}
+
+void LeoIpv4NetworkConfigurator::installRouteRecords(const std::vector<int32_t>& records)
+{
+    if (records.empty())
+        return;
+    for (size_t r = 0; r < records.size(); r += 3) {
+        if (LeoIpv4* ipv4Mod = getIpv4Module(records[r])) {
+            int nextHopID = neighbourInterfaces.getInterfaceId(records[r], records[r + 2] & ~ROUTE_EQUAL_COST_FLAG);
+            ipv4Mod->addKNextHop((records[r + 1] >> ROUTE_RANK_SHIFT) + 1, records[r + 1] & ROUTE_DESTINATION_MASK, nextHopID,
+                                 (records[r + 2] & ROUTE_EQUAL_COST_FLAG) != 0);
+        }
+        if (!routeState.isEmpty())
+            routeState.set(records[r], records[r + 1] >> ROUTE_RANK_SHIFT, records[r + 1] & ROUTE_DESTINATION_MASK, records[r + 2]);
+    }
+}
+
+void LeoIpv4NetworkConfigurator::flushRouteFile()
+{
+    // Hands the routes of the interval to the archive writer thread, which stores
+    // them as the difference to the interval written before
+    if (!routeFilePending)
+        return;
+    routeFilePending = false;
+    std::string archiveName = filePrefix + "/" + LEO_ROUTE_ARCHIVE_NAME;
+    if (!routeArchiveWriter.isOpen()) {
+        if (!std::filesystem::is_directory(filePrefix))
+            std::filesystem::create_directory(filePrefix);
+        if (!routeArchiveWriter.open(archiveName, routeFileCompression, routeKeyframeSpacing))
+            throw cRuntimeError("Cannot create route archive %s", archiveName.c_str());
+    }
+    if (!routeArchiveWriter.append(pendingRouteInterval.raw(), routeState))
+        throw cRuntimeError("Cannot write the routes of interval %s to route archive %s", pendingRouteInterval.str().c_str(), archiveName.c_str());
+}
+
+bool LeoIpv4NetworkConfigurator::applyRouteFile(const uint8_t *data, size_t size, const std::string& source)
+{
+    std::string error;
+    if (!decodeRouteFile(data, size, loadedRoutes, error))
+        throw cRuntimeError("Cannot load route file %s: %s", source.c_str(), error.c_str());
+    installDecodedRoutes(source);
+    return true;
+}
+
+void LeoIpv4NetworkConfigurator::installDecodedRoutes(const std::string& source)
+{
+    // Tables only receive the changed routes, unless the rotation of the in-flight
+    // window emptied them, the changes do not reach back to the interval they
+    // hold or their node reaches its neighbours through other interfaces now;
+    // those are reinstalled in full from the decoded state
+    const LeoRouteState& state = loadedRoutes.state;
+    const int numNodes = state.getNumNodes();
+    if (numNodes != (int)(numOfSats + numOfGS))
+        throw cRuntimeError("Route file %s holds routes of %d nodes, but the network has %d", source.c_str(), numNodes, numOfSats + numOfGS);
+    loadedNeighbours.resize(numNodes);
+    const bool tablesKept = inFlightWindow == 0 && loadedRoutes.changesBase != LEO_ROUTE_KEYFRAME && loadedRoutes.changesBase == installedRouteInterval;
+    installedRouteInterval = loadedRoutes.interval;
+    if (tablesKept)
+        deltaRouteLoads++;
+    for (int nodeNum = 0; nodeNum < numNodes; nodeNum++) {
+        LeoIpv4 *ipv4Mod = getIpv4Module(nodeNum);
+        if (ipv4Mod == nullptr)
+            continue;
+        const std::vector<LeoNeighbourInterfaceMap::Entry>& neighbours = neighbourInterfaces.getNeighbours(nodeNum);
+        if (tablesKept && neighbours == loadedNeighbours[nodeNum]) {
+            for (size_t c = loadedRoutes.nodeChanges[nodeNum]; c < loadedRoutes.nodeChanges[nodeNum + 1]; c++) {
+                const LeoRouteChange& change = loadedRoutes.changes[c];
+                installLoadedRoute(ipv4Mod, nodeNum, change.rank, change.destination, change.nextHop, source);
+            }
+            continue;
+        }
+        installNodeRoutes(ipv4Mod, nodeNum, source);
+    }
+}
+
+void LeoIpv4NetworkConfigurator::installNodeRoutes(LeoIpv4 *ipv4Mod, int nodeNum, const std::string& source)
+{
+    const LeoRouteState& state = loadedRoutes.state;
+    loadedNeighbours[nodeNum] = neighbourInterfaces.getNeighbours(nodeNum);
+    ipv4Mod->clearNextHops();
+    const int32_t *entries = state.getNodeEntries(nodeNum);
+    for (int rank = 0; rank < state.getNumRanks(); rank++) {
+        for (int destination = 0; destination < state.getNumDestinations(); destination++) {
+            const int32_t nextHop = entries[rank * state.getNumDestinations() + destination];
+            if (nextHop != LeoRouteState::NO_ROUTE)
+                installLoadedRoute(ipv4Mod, nodeNum, rank, destination, nextHop, source);
+        }
+    }
+}
+
+void LeoIpv4NetworkConfigurator::loadRouteEntries(int entryNum)
+{
+    // Only the file headers up to the interval are checked here; the tables are
+    // decoded node by node in materializeNodeRoutes() when they are first used
+    const std::string archiveName = filePrefix + "/" + LEO_ROUTE_ARCHIVE_NAME;
+    const LeoRouteArchiveEntry *entries = routeArchive.getEntries();
+    // Entries before the nearest keyframe are never decoded again
+    for (int e = std::max(loadedRouteEntry + 1, (int)routeArchive.findKeyframe(entryNum)); e <= entryNum; e++) {
+        const uint8_t *data;
+        size_t size;
+        LeoRouteFileHeader header;
+        if (!routeArchive.getRouteFile(entries[e], routeFileBuffer, data, size) || size < sizeof(header))
+            throw cRuntimeError("Corrupt routes of interval %s in %s", SimTime::fromRaw(entries[e].interval).str().c_str(), archiveName.c_str());
+        memcpy(&header, data, sizeof(header));
+        if (header.magic != LEO_ROUTE_FILE_MAGIC || header.version != LEO_ROUTE_FILE_VERSION || header.interval != entries[e].interval)
+            throw cRuntimeError("Corrupt routes of interval %s in %s", SimTime::fromRaw(entries[e].interval).str().c_str(), archiveName.c_str());
+        if (header.base != entries[e].base)
+            throw cRuntimeError("Routes of interval %s in %s are not based on the interval before", SimTime::fromRaw(entries[e].interval).str().c_str(), archiveName.c_str());
+        if (header.base != LEO_ROUTE_KEYFRAME)
+            continue;
+        keyframeRouteEntry = e;
+        const LeoRouteBlockReader& block = getRouteBlock(e);
+        LeoRouteState& state = loadedRoutes.state;
+        if (state.getNumNodes() != block.getNumNodes() || state.getNumRanks() != block.getNumRanks() || state.getNumDestinations() != block.getNumDestinations()) {
+            if (block.getNumNodes() != (int)(numOfSats + numOfGS))
+                throw cRuntimeError("Route archive %s holds routes of %d nodes, but the network has %d", archiveName.c_str(), block.getNumNodes(), numOfSats + numOfGS);
+            state.reset(block.getNumNodes(), block.getNumRanks(), block.getNumDestinations());
+            nodeRouteEntries.assign(block.getNumNodes(), -1);
+            loadedNeighbours.resize(block.getNumNodes());
+        }
+    }
+    if (keyframeRouteEntry < 0)
+        throw cRuntimeError("Route archive %s holds no full routes before interval %s", archiveName.c_str(), SimTime::fromRaw(entries[entryNum].interval).str().c_str());
+    loadedRouteEntry = entryNum;
+}
+
+const LeoRouteBlockReader& LeoIpv4NetworkConfigurator::getRouteBlock(int entryNum)
+{
+    LeoRouteBlockReader& block = routeBlocks[entryNum];
+    if (block.getBlockSize() > 0)
+        return block;
+    // Entries are uncompressed with lazyRouteLoading, so the block stays in the mapping
+    const LeoRouteArchiveEntry& entry = routeArchive.getEntries()[entryNum];
+    const uint8_t *data;
+    size_t size;
+    routeArchive.getRouteFile(entry, routeFileBuffer, data, size);
+    const LeoRouteState& state = loadedRoutes.state;
+    bool valid = block.open(data + sizeof(LeoRouteFileHeader), size - sizeof(LeoRouteFileHeader))
+                 && block.isKeyframe() == (entry.base == LEO_ROUTE_KEYFRAME);
+    if (valid && !block.isKeyframe()) {
+        // deltas must match the state of the keyframe they build on
+        valid = block.getNumNodes() == state.getNumNodes() && block.getNumRanks() == state.getNumRanks()
+                && block.getNumDestinations() == state.getNumDestinations();
+    }
+    if (!valid) {
+        block = LeoRouteBlockReader();
+        throw cRuntimeError("Corrupt route block of interval %s in %s/%s", SimTime::fromRaw(entry.interval).str().c_str(), filePrefix.c_str(), LEO_ROUTE_ARCHIVE_NAME);
+    }
+    return block;
+}
+
+void LeoIpv4NetworkConfigurator::materializeNodeRoutes(int nodeNum)
+{
+    // Brings the table of a node from the interval it was last used in up to the
+    // loaded one. Only its own sections of the route blocks in between are
+    // decoded, so nodes that forward nothing never cost more than the header check.
+    const std::string archiveName = filePrefix + "/" + LEO_ROUTE_ARCHIVE_NAME;
+    LeoRouteState& state = loadedRoutes.state;
+    int entryNum = nodeRouteEntries[nodeNum];
+    const bool reinstall = entryNum < keyframeRouteEntry;
+    if (reinstall) {
+        state.clearNode(nodeNum);
+        entryNum = keyframeRouteEntry - 1;
+    }
+    changedRouteKeys.clear();
+    for (entryNum++; entryNum <= loadedRouteEntry; entryNum++) {
+        const bool valid = getRouteBlock(entryNum).forEachChange(nodeNum, [&](int rank, int destination, int32_t nextHop) {
+            state.set(nodeNum, rank, destination, nextHop);
+            changedRouteKeys.push_back(rank * state.getNumDestinations() + destination);
+        });
+        if (!valid)
+            throw cRuntimeError("Corrupt routes of node %d for interval %s in %s", nodeNum,
+                                SimTime::fromRaw(routeArchive.getEntries()[entryNum].interval).str().c_str(), archiveName.c_str());
+    }
+    nodeRouteEntries[nodeNum] = loadedRouteEntry;
+    materializedRouteTables++;
+
+    LeoIpv4 *ipv4Mod = getIpv4Module(nodeNum);
+    if (ipv4Mod == nullptr)
+        return;
+    if (reinstall || neighbourInterfaces.getNeighbours(nodeNum) != loadedNeighbours[nodeNum]) {
+        installNodeRoutes(ipv4Mod, nodeNum, archiveName);
+        return;
+    }
+    // A route may have changed more than once since the table was used; the next
+    // hops in between can be gone by now, so only the final ones are installed
+    const int32_t *entries = state.getNodeEntries(nodeNum);
+    for (int key : changedRouteKeys)
+        installLoadedRoute(ipv4Mod, nodeNum, key / state.getNumDestinations(), key % state.getNumDestinations(), entries[key], archiveName);
+}
+
+void LeoIpv4NetworkConfigurator::installLoadedRoute(LeoIpv4 *ipv4Mod, int nodeNum, int rank, int destination, int32_t nextHop, const std::string& source)
+{
+    int nextHopId = 0;
+    if (nextHop != LeoRouteState::NO_ROUTE) {
+        const int nextHopNodeNum = nextHop & ~ROUTE_EQUAL_COST_FLAG;
+        nextHopId = neighbourInterfaces.getInterfaceId(nodeNum, nextHopNodeNum);
+        if (nextHopId <= 0)
+            throw cRuntimeError("Failed to resolve current interface for source node %d via next-hop node %d in %s",
+                                nodeNum, nextHopNodeNum, source.c_str());
+    }
+    ipv4Mod->addKNextHop(rank + 1, destination, nextHopId, (nextHop & ROUTE_EQUAL_COST_FLAG) != 0 && nextHop != LeoRouteState::NO_ROUTE);
 }
 
 void LeoIpv4NetworkConfigurator::addNextHopInterface(cModule* source, cModule* destination, int interfaceID)
@@ -514,7 +1451,107 @@ void LeoIpv4NetworkConfigurator::addNextHopInterface(cModule* source, cModule* d
     auto destinationIt = moduleGraphIdByModule.find(destination);
     if (sourceIt == moduleGraphIdByModule.end() || destinationIt == moduleGraphIdByModule.end())
         return;
-    nextHopInterfaceMatrix[sourceIt->second][destinationIt->second] = interfaceID;
+    neighbourInterfaces.setInterfaceId(sourceIt->second, destinationIt->second, interfaceID);
+}
+
+void LeoIpv4NetworkConfigurator::handleMessage(cMessage *msg)
+{
+    if (msg != failureTimer)
+        throw cRuntimeError("Unknown message %s", msg->getName());
+    while (nextFailureEvent < failureEvents.size() && failureEvents[nextFailureEvent].time <= simTime()) {
+        const FailureEvent& event = failureEvents[nextFailureEvent++];
+        if (event.type == "node")
+            injectNodeFailure(event.node);
+        else if (event.type == "link")
+            injectLinkFailure(event.node, event.neighbour);
+        else
+            repairFailures();
+    }
+    if (nextFailureEvent < failureEvents.size())
+        scheduleAt(failureEvents[nextFailureEvent].time, failureTimer);
+}
+
+void LeoIpv4NetworkConfigurator::parseFailureSchedule(const char *schedule)
+{
+    // e.g. "100s node 12; 150s link 3 4; 200s repair"
+    cStringTokenizer eventTokenizer(schedule, ";");
+    while (eventTokenizer.hasMoreTokens()) {
+        const std::string eventString = eventTokenizer.nextToken();
+        std::vector<std::string> fields = cStringTokenizer(eventString.c_str()).asVector();
+        if (fields.empty())
+            continue;
+        FailureEvent event;
+        event.time = SimTime::parse(fields[0].c_str());
+        event.type = fields.size() > 1 ? fields[1] : "";
+        const size_t numNodes = event.type == "node" ? 1 : event.type == "link" ? 2 : event.type == "repair" ? 0 : SIZE_MAX;
+        if (numNodes == SIZE_MAX || fields.size() != numNodes + 2)
+            throw cRuntimeError("Invalid failure event '%s', expected '<time> node <n>', '<time> link <n> <m>' or '<time> repair'",
+                                eventString.c_str());
+        for (size_t i = 0; i < numNodes; i++) {
+            char *end;
+            const long nodeNum = strtol(fields[i + 2].c_str(), &end, 10);
+            if (fields[i + 2].empty() || *end != '\0' || nodeNum < 0 || nodeNum >= (long)(numOfSats + numOfGS))
+                throw cRuntimeError("Invalid node '%s' in failure event '%s', expected a satellite or ground station number below %d",
+                                    fields[i + 2].c_str(), eventString.c_str(), (int)(numOfSats + numOfGS));
+            (i == 0 ? event.node : event.neighbour) = nodeNum;
+        }
+        failureEvents.push_back(event);
+    }
+    std::stable_sort(failureEvents.begin(), failureEvents.end(), [](const FailureEvent& a, const FailureEvent& b) { return a.time < b.time; });
+}
+
+void LeoIpv4NetworkConfigurator::setLinkState(int node, int neighbour, bool up)
+{
+    for (int direction = 0; direction < 2; direction++) {
+        const int from = direction == 0 ? node : neighbour;
+        const int to = direction == 0 ? neighbour : node;
+        const int interfaceId = neighbourInterfaces.getInterfaceId(from, to);
+        if (interfaceId <= 0 || nodeModules[from] == nullptr)
+            continue;
+        IInterfaceTable *ift = check_and_cast<IInterfaceTable *>(nodeModules[from]->getSubmodule("interfaceTable"));
+        if (NetworkInterface *networkInterface = ift->getInterfaceById(interfaceId)) {
+            networkInterface->setState(up ? NetworkInterface::State::UP : NetworkInterface::State::DOWN);
+            networkInterface->setCarrier(up);
+        }
+    }
+}
+
+void LeoIpv4NetworkConfigurator::injectNodeFailure(int nodeNum)
+{
+    if (nodeNum < 0 || nodeNum >= (int)(numOfSats + numOfGS))
+        throw cRuntimeError("Cannot fail node %d, only satellites and ground stations can fail", nodeNum);
+    EV_INFO << "Failing node " << nodeNum << " at " << simTime() << endl;
+    failedNodes[nodeNum] = 1;
+    for (const LeoNeighbourInterfaceMap::Entry& entry : neighbourInterfaces.getNeighbours(nodeNum))
+        setLinkState(nodeNum, entry.first, false);
+    invalidateForwardingDecisions();
+}
+
+void LeoIpv4NetworkConfigurator::injectLinkFailure(int nodeNum, int neighbourNum)
+{
+    if (neighbourInterfaces.getInterfaceId(nodeNum, neighbourNum) <= 0)
+        throw cRuntimeError("Cannot fail link %d - %d, the nodes are not connected", nodeNum, neighbourNum);
+    EV_INFO << "Failing link " << nodeNum << " - " << neighbourNum << " at " << simTime() << endl;
+    failedLinks.insert(((uint64_t)nodeNum << 32) | (uint32_t)neighbourNum);
+    failedLinks.insert(((uint64_t)neighbourNum << 32) | (uint32_t)nodeNum);
+    setLinkState(nodeNum, neighbourNum, false);
+    invalidateForwardingDecisions();
+}
+
+void LeoIpv4NetworkConfigurator::repairFailures()
+{
+    EV_INFO << "Repairing all failures at " << simTime() << endl;
+    for (int nodeNum = 0; nodeNum < (int)failedNodes.size(); nodeNum++) {
+        if (!failedNodes[nodeNum])
+            continue;
+        for (const LeoNeighbourInterfaceMap::Entry& entry : neighbourInterfaces.getNeighbours(nodeNum))
+            setLinkState(nodeNum, entry.first, true);
+        failedNodes[nodeNum] = 0;
+    }
+    for (uint64_t link : failedLinks)
+        setLinkState(link >> 32, (int)(uint32_t)link, true);
+    failedLinks.clear();
+    invalidateForwardingDecisions();
 }
 
 void LeoIpv4NetworkConfigurator::removeNextHopInterface(cModule* source, cModule* destination)
@@ -523,7 +1560,7 @@ void LeoIpv4NetworkConfigurator::removeNextHopInterface(cModule* source, cModule
     auto destinationIt = moduleGraphIdByModule.find(destination);
     if (sourceIt == moduleGraphIdByModule.end() || destinationIt == moduleGraphIdByModule.end())
         return;
-    nextHopInterfaceMatrix[sourceIt->second][destinationIt->second] = -1;
+    neighbourInterfaces.removeInterfaceId(sourceIt->second, destinationIt->second);
 }
 
 void LeoIpv4NetworkConfigurator::addGSLinktoTopologyGraph(int sourceNum, int destNum, double weight)
@@ -571,10 +1608,6 @@ cModule* LeoIpv4NetworkConfigurator::getClientServerModule(bool client, int node
     return mod;
 }
 
-#include <fstream>
-#include <filesystem>
-#include <map>
-
 void LeoIpv4NetworkConfigurator::writeModuleIDMappingsToFile(const std::string& filePath)
 {
     namespace fs = std::filesystem;
@@ -735,37 +1768,41 @@ int LeoIpv4NetworkConfigurator::getNextHopInterfaceID(cModule* sourceSatellite,
     return interfaceID;
 }
 
+int LeoIpv4NetworkConfigurator::getPeerNodeNum(cGate *outputGate)
+{
+    cGate *endGate = outputGate->getPathEndGate();
+    if (endGate == nullptr || endGate == outputGate)
+        return -1;
+    // The link ends inside the PPP interface of the peer (or at its pppg gate if no interface is attached yet)
+    for (cModule *mod = endGate->getOwnerModule(); mod != nullptr; mod = mod->getParentModule()) {
+        auto it = moduleGraphIdByModule.find(mod);
+        if (it != moduleGraphIdByModule.end())
+            return it->second;
+    }
+    return -1;
+}
+
 void LeoIpv4NetworkConfigurator::fillNextHopInterfaceMap()
 {
+    // Each point-to-point interface is followed once to the node at the other end of
+    // its link, so the cost grows with the number of links rather than with node pairs
     for(int nodeNum = 0; nodeNum < nodeModules.size(); nodeNum++){
         cModule *mod = nodeModules[nodeNum];
-        for(int nextHopNodeNum = 0; nextHopNodeNum < nodeModules.size(); nextHopNodeNum++){
-            if(nodeNum != nextHopNodeNum){
-                cModule *nextHopMod = nodeModules[nextHopNodeNum];
-                IInterfaceTable* sourceIft = dynamic_cast<IInterfaceTable*>(mod->getSubmodule("interfaceTable"));
-                IInterfaceTable* nextHopIft = dynamic_cast<IInterfaceTable*>(nextHopMod->getSubmodule("interfaceTable"));
-
-                for (int i = 0; i < sourceIft->getNumInterfaces(); i++) {
-                    NetworkInterface *srcIE = sourceIft->getInterface(i);
-                    if (!(srcIE->isPointToPoint())){
-                        addIpAddressMap(srcIE->getIpv4Address().getInt(), mod->getFullName());
-                        continue;
-                    }
-                    cGate* srcGateMod = mod->gate(srcIE->getNodeOutputGateId());
-                    for (int j = 0; j < nextHopIft->getNumInterfaces(); j++) {
-                        NetworkInterface *nextHopIE = nextHopIft->getInterface(j);
-                        if (!(nextHopIE->isPointToPoint())){
-                            continue;
-                        }
-                        cGate* nextHopGateMod = nextHopMod->gate(nextHopIE->getNodeInputGateId());
-                        if(srcGateMod->getPathEndGate() == nextHopGateMod->getPathEndGate()){
-                            addIpAddressMap(srcIE->getIpv4Address().getInt(), mod->getFullName());
-                            if(nodeNum < numOfSats+numOfGS){
-                                nextHopInterfaceMatrix[nodeNum][nextHopNodeNum] = srcIE->getInterfaceId();
-                            }
-                        }
-                    }
-                }
+        if (mod == nullptr)
+            continue;
+        IInterfaceTable* sourceIft = dynamic_cast<IInterfaceTable*>(mod->getSubmodule("interfaceTable"));
+        for (int i = 0; i < sourceIft->getNumInterfaces(); i++) {
+            NetworkInterface *srcIE = sourceIft->getInterface(i);
+            if (!(srcIE->isPointToPoint())){
+                addIpAddressMap(srcIE->getIpv4Address().getInt(), mod->getFullName());
+                continue;
+            }
+            int nextHopNodeNum = getPeerNodeNum(mod->gate(srcIE->getNodeOutputGateId()));
+            if (nextHopNodeNum < 0 || nextHopNodeNum == nodeNum)
+                continue;
+            addIpAddressMap(srcIE->getIpv4Address().getInt(), mod->getFullName());
+            if(nodeNum < numOfSats+numOfGS){
+                neighbourInterfaces.setInterfaceId(nodeNum, nextHopNodeNum, srcIE->getInterfaceId());
             }
         }
     }
@@ -814,22 +1851,66 @@ double LeoIpv4NetworkConfigurator::computeWiredLinkWeight(Link *link, const char
         throw cRuntimeError("Unknown metric");
 }
 
-int LeoIpv4NetworkConfigurator::getModuleIdFromIpAddress(int address)
+void LeoIpv4NetworkConfigurator::setAddressPlan(Ipv4Address base, Ipv4Address netmask)
+{
+    const uint32_t mask = netmask.getInt();
+    int hostBits = 0;
+    while (hostBits < 32 && !(mask & (1u << hostBits)))
+        hostBits++;
+    int nodeBits = 0;
+    while ((1u << nodeBits) < nodeModules.size())
+        nodeBits++;
+
+    // at least two interface bits, so that the host part is never all zeros or all ones
+    interfaceAddressBits = hostBits - nodeBits;
+    if (interfaceAddressBits < 2)
+        throw cRuntimeError("Netmask %s leaves %d host bits, too few to address %d nodes",
+                            netmask.str().c_str(), hostBits, (int)nodeModules.size());
+    addressPlanBase = base.getInt() & mask;
+    addressPlanNetmask = mask;
+    numAddressedNodes = nodeModules.size();
+    EV_INFO << "Address plan: " << Ipv4Address(addressPlanBase) << "/" << (32 - hostBits) << ", " << nodeBits
+            << " node bits, " << interfaceAddressBits << " interface bits" << endl;
+}
+
+Ipv4Address LeoIpv4NetworkConfigurator::getInterfaceAddress(cModule *node, int interfaceIndex)
+{
+    if (numAddressedNodes == 0)
+        throw cRuntimeError("Address plan is not set");
+    auto it = moduleGraphIdByModule.find(node);
+    if (it == moduleGraphIdByModule.end())
+        throw cRuntimeError("Cannot assign an address to %s, it is not a node of the network", node->getFullPath().c_str());
+    if (interfaceIndex < 0 || interfaceIndex + 2 >= (1 << interfaceAddressBits))
+        throw cRuntimeError("Interface %d of %s does not fit in the %d interface bits of the address plan",
+                            interfaceIndex, node->getFullPath().c_str(), interfaceAddressBits);
+    return Ipv4Address(addressPlanBase | ((uint32_t)it->second << interfaceAddressBits) | (uint32_t)(interfaceIndex + 1));
+}
+
+int LeoIpv4NetworkConfigurator::findRouterIdNode(uint32_t address) const
 {
+    // addresses outside of the plan, e.g. assigned by another configurator
     auto it = routerIdMap.find(address);
     return it == routerIdMap.end() ? -1 : it->second;
 }
 
+int LeoIpv4NetworkConfigurator::getModuleIdFromIpAddress(int address)
+{
+    return getNodeIdFromAddress(address);
+}
+
 void LeoIpv4NetworkConfigurator::addIpAddressMap(int address, std::string modName)
 {
     auto it = moduleGraphIDMap.find(modName);
-    if (it != moduleGraphIDMap.end())
+    if (it != moduleGraphIDMap.end()) {
         routerIdMap[address] = it->second;
+        invalidateForwardingDecisions();
+    }
 }
 
 void LeoIpv4NetworkConfigurator::eraseIpAddressMap(int address)
 {
-    routerIdMap.erase(address);
+    if (routerIdMap.erase(address) > 0)
+        invalidateForwardingDecisions();
 }
 
 int LeoIpv4NetworkConfigurator::getNodeModuleGraphId(std::string nodeStr)
@@ -840,63 +1921,57 @@ int LeoIpv4NetworkConfigurator::getNodeModuleGraphId(std::string nodeStr)
 
 void LeoIpv4NetworkConfigurator::addIpv4NextHop(cModule* mod, int destAddr, int nextHopId)
 {
-    LeoIpv4* ipv4Mod = dynamic_cast<LeoIpv4*>(mod->getModuleByPath(".ipv4.ip"));
-    ipv4Mod->addKNextHop(1, destAddr, nextHopId);
-    ipv4Mod->addNextHop(destAddr, nextHopId);
+    auto it = moduleGraphIdByModule.find(mod);
+    LeoIpv4* ipv4Mod = it != moduleGraphIdByModule.end() ? getIpv4Module(it->second) : nullptr;
+    if (ipv4Mod != nullptr) {
+        ipv4Mod->addKNextHop(1, destAddr, nextHopId);
+        invalidateForwardingDecisions();
+    }
 }
 
 int LeoIpv4NetworkConfigurator::getGroundStationFromEndPoint(int endPointModID)
 {
-    auto it = endpointToNodeMap.find(endPointModID);
-    if (it != endpointToNodeMap.end()) {
-        return it->second;
-    }
-    return -1;
+    return getAttachedNode(endPointModID);
 }
 
 // 0 = sat, 1 = gs, 2 = endpoint, -1 = unknown
 int LeoIpv4NetworkConfigurator::getNodeTypeCode(int modId)
 {
-    if (modId < 0) return -1;
+    return getNodeType(modId);
+}
 
-    if (modId < numOfSats) //Satellite
-        return 0;
-    else if (modId < numOfSats + numOfGS) //Ground Station
-        return 1;
-    else if (modId < numOfSats + numOfGS + (numOfClients*2) + numOfUserTerminals) // Client, Server, or User Terminal
-        return 2;
-    else
-        return -1;
+LeoIpv4 *LeoIpv4NetworkConfigurator::getIpv4Module(int nodeNum)
+{
+    LeoIpv4 *ipv4Mod = ipv4Modules[nodeNum];
+    if (ipv4Mod == nullptr && nodeModules[nodeNum] != nullptr) {
+        ipv4Mod = dynamic_cast<LeoIpv4 *>(nodeModules[nodeNum]->getModuleByPath(".ipv4.ip"));
+        ipv4Modules[nodeNum] = ipv4Mod;
+        // Only satellites and ground stations forward, endpoints send everything over their uplink
+        if (ipv4Mod != nullptr && nodeNum < (int)(numOfSats + numOfGS) && !sourceRouting) {
+            if (rangeForwardingTables)
+                ipv4Mod->getForwardingTable().attachRanges(forwardingArena.getNumDestinations(), forwardingArena.getNumRanks());
+            else
+                ipv4Mod->getForwardingTable().attach(forwardingArena.getTableEntries(nodeNum), forwardingArena.getNumDestinations(), forwardingArena.getNumRanks());
+        }
+    }
+    return ipv4Mod;
 }
 
 void LeoIpv4NetworkConfigurator::setIpv4NodeIds()
 {
     for (size_t id = 0; id < nodeModules.size(); id++) {
-        cModule *mod = nodeModules[id];
-        if (mod == nullptr)
-            continue;
-
-        LeoIpv4* ipv4Mod = ipv4Modules[id];
-        if (ipv4Mod == nullptr) {
-            cModule* ipModule = mod->getModuleByPath(".ipv4.ip");
-            if (!ipModule)
-                continue;
-            ipv4Mod = dynamic_cast<LeoIpv4*>(ipModule);
-            ipv4Modules[id] = ipv4Mod;
-        }
-        if (ipv4Mod != nullptr)
+        if (LeoIpv4* ipv4Mod = getIpv4Module(id))
             ipv4Mod->setNodeId(id);
     }
 }
 
 void LeoIpv4NetworkConfigurator::setGroundStationsWithEndpoints()
 {
-    endpointToNodeMap.clear();
-    endpointAttachmentInterfaceIds.clear();
-    endpointUplinkInterfaceIds.clear();
-    for (size_t modId = 0; modId < nodeModules.size(); modId++) {
-        nodeNumEndpointsMap[modId] = 0;
-    }
+    invalidateForwardingDecisions();
+    endpointAttachedNodes.assign(nodeModules.size(), -1);
+    nodeNumEndpoints.assign(nodeModules.size(), 0);
+    endpointAttachmentInterfaceIds.assign(nodeModules.size(), -1);
+    endpointUplinkInterfaceIds.assign(nodeModules.size(), -1);
 
     for (size_t modId = 0; modId < nodeModules.size(); modId++) {
         cModule *modulePtr = nodeModules[modId];
@@ -941,37 +2016,31 @@ void LeoIpv4NetworkConfigurator::setGroundStationsWithEndpoints()
             if (attachedNodeId < 0)
                 continue;
 
-            endpointToNodeMap[modId] = attachedNodeId;
-            nodeNumEndpointsMap[attachedNodeId] = nodeNumEndpointsMap[attachedNodeId] + 1;
+            endpointAttachedNodes[modId] = attachedNodeId;
+            nodeNumEndpoints[attachedNodeId]++;
             endpointAttachmentInterfaceIds[modId] = attachedInterface->getInterfaceId();
             endpointUplinkInterfaceIds[modId] = endpointInterface->getInterfaceId();
             break;
         }
     }
+
+    if (destinationRootedRouting && !lazyRouting && !loadFiles) {
+        for (int attachedNodeId : endpointAttachedNodes)
+            if (attachedNodeId >= 0)
+                ensureDestinationRoutes(attachedNodeId);
+    }
 }
 
 int LeoIpv4NetworkConfigurator::getEndpointAttachmentInterfaceId(int nodeId) {
-    auto endPointInterface = endpointAttachmentInterfaceIds.find(nodeId);
-    if(endPointInterface != endpointAttachmentInterfaceIds.end()){
-        return endPointInterface->second;
-    }
-    return -1;
+    return getAttachmentInterface(nodeId);
 }
 
 int LeoIpv4NetworkConfigurator::getEndpointUplinkInterfaceId(int nodeId) {
-    auto endPointInterface = endpointUplinkInterfaceIds.find(nodeId);
-    if(endPointInterface != endpointUplinkInterfaceIds.end()){
-        return endPointInterface->second;
-    }
-    return -1;
+    return getUplinkInterface(nodeId);
 }
 
 int LeoIpv4NetworkConfigurator::getTotalEndpoints(int nodeId) {
-    auto numEndpoints = nodeNumEndpointsMap.find(nodeId);
-    if(numEndpoints != nodeNumEndpointsMap.end()){
-        return numEndpoints->second;
-    }
-    return 0;
+    return nodeId >= 0 && nodeId < (int)nodeNumEndpoints.size() ? nodeNumEndpoints[nodeId] : 0;
 }
 // TODO If we set IPAddress in LeoChannelConstructor, do we need this? doubt it
 //void LeoIpv4NetworkConfigurator::configureInterface(InterfaceInfo *interfaceInfo)
@@ -17,19 +17,29 @@
 #define NETWORKLAYER_CONFIGURATOR_IPV4_LEOIPV4NETWORKCONFIGURATOR_H_
 
 #include <algorithm>
+#include <deque>
+#include <fstream>
 #include <igraph.h>
 #include <queue>
 #include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <inet/common/Topology.h>
 #include "inet/networklayer/configurator/base/L3NetworkConfiguratorBase.h"
 #include <inet/networklayer/ipv4/Ipv4InterfaceData.h>
 
+#include "LeoContractionHierarchy.h"
+#include "LeoNeighbourInterfaceMap.h"
+#include "LeoRouteArchive.h"
+#include "LeoRouteFile.h"
+#include "LeoRoutePrefetcher.h"
+#include "LeoRoutingGraph.h"
 #include "../../ipv4/LeoIpv4.h"
 #include "../../ipv4/LeoIpv4RoutingTable.h"
 #include "../../../mobility/SatelliteMobility.h"
 #include "../../../mobility/GroundStationMobility.h"
+#include "../../../mobility/NoradA.h"
 
 #include <chrono> //TODO remove if not using analysing runtime
 
@@ -38,8 +48,9 @@ class INET_API LeoIpv4NetworkConfigurator : public L3NetworkConfiguratorBase {
 protected:
     //typedef igraph_error_type_t igraph_error_t;
     virtual int numInitStages() const override { return NUM_INIT_STAGES; }
-    virtual void handleMessage(cMessage *msg) override { throw cRuntimeError("this module doesn't handle messages, it runs only in initialize()"); }
+    virtual void handleMessage(cMessage *msg) override;
     virtual void initialize(int stage) override;
+    virtual void finish() override;
 
     virtual double computeLinkWeight(Link *link, const char *metric, cXMLElement *parameters=nullptr) override;
     virtual double computeWiredLinkWeight(Link *link, const char *metric, cXMLElement *parameters=nullptr) override;
@@ -51,16 +62,48 @@ protected:
     virtual void writeModuleIDMappingsToFile(const std::string& filename);
     virtual void verifyModuleIDMappingsFromFile(const std::string& filePath);
     virtual void updateModuleIDMappingsClientServer();
+
+    virtual void collectTopologyEdges(std::vector<int>& edgeEndpoints, std::vector<double>& edgeWeights);
+    virtual void addQueueingDelays(const std::vector<int>& edgeEndpoints, std::vector<double>& edgeWeights);
+    virtual double getQueueingDelay(int node, int neighbour);
+    virtual void computeSourceRoutes(int numThreads);
+    virtual void computeIncrementalRoutes(const std::vector<int>& edgeEndpoints, const std::vector<double>& edgeWeights);
+    virtual void computeDestinationRoutes(const std::vector<int>& edgeEndpoints, const std::vector<double>& edgeWeights);
+    virtual void computeDestinationTrees(const std::vector<int>& destinations);
+    virtual void ensureDestinationRoutes(int nodeNum);
+    virtual void installRouteRecords(const std::vector<int32_t>& records);
+
+    // version 3 route files, one delta per interval
+    virtual void flushRouteFile();
+    virtual bool applyRouteFile(const uint8_t *data, size_t size, const std::string& source);
+    virtual void installDecodedRoutes(const std::string& source);
+    virtual void installNodeRoutes(LeoIpv4 *ipv4Mod, int nodeNum, const std::string& source);
+    virtual void installLoadedRoute(LeoIpv4 *ipv4Mod, int nodeNum, int rank, int destination, int32_t nextHop, const std::string& source);
 protected:
     //internal state
     Topology topology;
     bool loadFiles;
     std::vector<cModule*> nodeModules;
     std::vector<LeoIpv4*> ipv4Modules;
+    LeoForwardingArena forwardingArena; // forwarding entries of all satellites and ground stations
+    LeoForwardingArena previousForwardingArena; // entries of the previous routing epoch, only with inFlightWindow > 0
+    LeoNeighbourInterfaceMap epochNeighbourInterfaces; // interfaces when the current epoch started, only with inFlightWindow > 0
+    LeoNeighbourInterfaceMap previousNeighbourInterfaces; // the same for the previous epoch
+    simtime_t inFlightWindow;
+    unsigned int routingEpoch = 0; // incremented by every updateForwardingStates()
+    simtime_t routingEpochStart;
+
+    // source routing, one shortest path tree per destination computed on demand
+    bool sourceRouting;
+    std::vector<LeoShortestPathTree> sourceRouteTrees;
+    LeoDijkstraScratch sourceRouteScratch;
+    bool rangeForwardingTables;
+    size_t peakForwardingTableBytes = 0;
+    size_t denseForwardingTableBytes = 0;
     std::unordered_map<cModule*, int> moduleGraphIdByModule;
 
-    std::map<SatelliteMobility*, std::vector<SatelliteMobility*>> satelliteISLMobilityModules;
-    std::vector<std::vector<int>> nextHopInterfaceMatrix;
+    std::vector<std::pair<SatelliteMobility*, SatelliteMobility*>> islMobilityPairs; // one entry per ISL, aligned with islVec
+    LeoNeighbourInterfaceMap neighbourInterfaces; // node -> (neighbour node -> interface ID)
     std::string networkName;
     std::string configLocation;
     std::string filePrefix;
@@ -73,7 +116,138 @@ protected:
     unsigned int numOfISLs;
     const char* linkMetric;
     std::queue<std::tuple<int, int, double>> groundStationLinks;
-    int numOfKPaths;
+    int numOfNextHops;
+    int numRoutingThreads;
+
+    // incremental routing state, one tree per root node kept across intervals
+    bool incrementalRouting;
+    std::vector<LeoShortestPathTree> routingTrees;
+    std::vector<int> routingTreeVersions; // routingGraphVersion each tree is valid for
+    LeoRoutingGraph previousRoutingGraph;
+    std::vector<LeoEdgeChange> routingGraphChanges; // from previousRoutingGraph to routingGraph
+    int routingGraphVersion = 0;
+    cOutVector scannedVerticesVector;
+    cOutVector scannedArcsVector;
+    long totalScannedVertices = 0;
+    long totalScannedArcs = 0;
+    long totalTreeUpdates = 0;
+
+    virtual LeoTreeRepairCount updateRoutingTree(int root, LeoDijkstraScratch& scratch);
+
+    // destination rooted routing, one tree per destination also used to rank the k next hops
+    bool destinationRootedRouting;
+    bool edgeDisjointKPaths;
+    double ecmpCostSlack; // relative path cost up to which alternatives are flagged as equal cost
+
+    // congestion aware link weights, propagation delay plus the smoothed queueing delay
+    bool congestionWeights;
+    double congestionDamping;
+    std::unordered_map<uint64_t, double> queueingDelayEstimates; // (node << 32 | neighbour) -> queueing delay in ms
+    cOutVector queueingDelayVector;
+
+    // injected failures, excluded from the routing graph until repaired
+    struct FailureEvent {
+        simtime_t time;
+        std::string type; // "node", "link" or "repair"
+        int node = -1;
+        int neighbour = -1;
+    };
+    std::vector<char> failedNodes;
+    std::unordered_set<uint64_t> failedLinks; // node << 32 | neighbour, both directions
+    std::vector<FailureEvent> failureEvents; // sorted by time
+    size_t nextFailureEvent = 0;
+    cMessage *failureTimer = nullptr;
+
+    virtual void parseFailureSchedule(const char *schedule);
+    virtual void setLinkState(int node, int neighbour, bool up);
+    virtual void removeFailedEdges(std::vector<int>& edgeEndpoints, std::vector<double>& edgeWeights);
+    LeoRoutingGraph routingGraph; // topology of the current interval
+    std::vector<char> routedDestinations;
+
+    // lazy routing, destinations are routed on the first miss in each interval
+    bool lazyRouting;
+    long lazyRoutedDestinations = 0; // in the current interval
+    long totalLazyRoutedDestinations = 0;
+    cOutVector lazyRoutedVector;
+
+    // point-to-point route queries on routingGraph
+    bool routeQueryHierarchy;
+    std::vector<LeoVertexPosition> nodePositions; // ECEF in meters when the graph was built
+    double routeQueryHeuristicScale = 0; // ms per metre of straight line distance, 0 if a position is unknown
+    LeoContractionHierarchy contractionHierarchy; // built on the first query of an interval
+    LeoDijkstraScratch routeQueryScratch;
+    cOutVector routeQueryLatencyVector;
+    long numRouteQueries = 0;
+    double totalRouteQueryLatency = 0; // us
+    double totalHierarchyBuildTime = 0; // us
+
+    virtual void prepareRouteQueries();
+
+    // change driven recomputation, routes are kept while the topology stays close
+    // to the one they were computed on
+    double routeDriftThreshold; // ms
+    std::vector<int> topologyEdgeEndpoints; // edges of the interval being routed
+    std::vector<double> topologyEdgeWeights;
+    uint64_t routedLinkSetHash = 0; // edge list the installed routes were computed on
+    std::vector<double> routedEdgeWeights;
+    long skippedRecomputations = 0;
+    cOutVector weightDriftVector;
+
+    virtual bool needsRecomputation();
+    virtual void reuseRoutes(simtime_t currentInterval);
+
+    // symmetry reuse, a Walker shell looks the same every orbital period /
+    // satPerPlane with every satellite moved one slot ahead in its plane
+    struct SymmetryPhase {
+        simtime_t time;
+        LeoRoutingGraph satelliteGraph; // ISLs only
+        std::vector<uint16_t> nextHops; // [destination * numOfSats + satellite], NO_SYMMETRIC_NEXT_HOP if none
+    };
+    static constexpr uint16_t NO_SYMMETRIC_NEXT_HOP = UINT16_MAX;
+    bool symmetryRouteReuse;
+    double symmetryShiftPeriod = 0; // s, read from NoradA on first use
+    double symmetryLag = 0; // s between an interval and the later one it can match, 0 until known
+    double symmetryTimeSlack = 0; // s an update may be off the lag and still match
+    std::deque<SymmetryPhase> symmetryHistory; // oldest first, covers symmetryLag
+    std::vector<uint16_t> symmetricNextHops;
+    long symmetricRouteReuses = 0;
+
+    virtual bool prepareSymmetricRoutes();
+    virtual void computeSymmetricRoutes(const std::vector<int>& edgeEndpoints, const std::vector<double>& edgeWeights);
+    virtual const SymmetryPhase *findSymmetricPhase(const LeoRoutingGraph& satelliteGraph, int& shift);
+    int shiftSatellite(int satNum, int shift) const
+    {
+        const int slot = satNum % satPerPlane;
+        return satNum - slot + (slot + shift) % satPerPlane;
+    }
+    LeoRouteState routeState; // routes of the current interval, written by flushRouteFile()
+    simtime_t pendingRouteInterval;
+    bool routeFilePending = false;
+    LeoDecodedRoutes loadedRoutes; // routes of the last loaded interval
+    int64_t installedRouteInterval = LEO_ROUTE_KEYFRAME; // interval the tables hold, LEO_ROUTE_KEYFRAME if unknown
+    long deltaRouteLoads = 0; // intervals installed from their changes alone
+    std::vector<std::vector<LeoNeighbourInterfaceMap::Entry>> loadedNeighbours; // per node, when its routes were last installed in full
+    std::vector<uint8_t> routeFileBuffer;
+    LeoRouteArchiveWriter routeArchiveWriter;
+    int routeFileCompression = 0;
+    int routeKeyframeSpacing = LEO_ROUTE_KEYFRAME_SPACING;
+    LeoRouteArchive routeArchive; // mapped when loading, per-interval files are used without it
+    LeoRoutePrefetcher routePrefetcher; // declared after routeArchive, stops before it is unmapped
+    bool prefetchRoutes = true;
+    simtime_t updateInterval; // between updateForwardingStates() calls, set by the channel constructor
+    long prefetchedRouteLoads = 0;
+
+    // lazy route loading, a table is brought up to the loaded interval on its first lookup
+    bool lazyRouteLoading = false;
+    int loadedRouteEntry = -1; // archive entry of the current interval
+    int keyframeRouteEntry = -1; // last keyframe entry up to it
+    std::vector<LeoRouteBlockReader> routeBlocks; // per archive entry, opened on first use
+    std::vector<int> nodeRouteEntries; // per node, entry its table holds, -1 for none
+    std::vector<int> changedRouteKeys;
+    long materializedRouteTables = 0;
+    virtual void loadRouteEntries(int entryNum);
+    virtual const LeoRouteBlockReader& getRouteBlock(int entryNum);
+    virtual void materializeNodeRoutes(int nodeNum);
 
     simtime_t currentInterval;
     igraph_vector_int_t islVec;
@@ -84,21 +258,39 @@ protected:
 
     std::unordered_map<std::string, int> moduleGraphIDMap;
 
-    std::unordered_map<int, int> endpointToNodeMap; // endPointModID → attached satellite or ground station ID
-    std::unordered_map<int, int> nodeNumEndpointsMap; // attached node ID → numOfEndPoints
-    std::unordered_map<int, int> endpointAttachmentInterfaceIds; // endPointModID → interface ID on attached node
-    std::unordered_map<int, int> endpointUplinkInterfaceIds; // endPointModID → interface ID on endpoint
+    // endpoint attachments, indexed by node ID
+    std::vector<int> endpointAttachedNodes; // endpoint → attached satellite or ground station ID, -1 if detached
+    std::vector<int> nodeNumEndpoints; // attached node ID → numOfEndPoints
+    std::vector<int> endpointAttachmentInterfaceIds; // endpoint → interface ID on attached node, -1 if detached
+    std::vector<int> endpointUplinkInterfaceIds; // endpoint → interface ID on endpoint, -1 if detached
+
+    // structured address plan: base | nodeId << interfaceAddressBits | (interfaceIndex + 1)
+    uint32_t addressPlanBase = 0;
+    uint32_t addressPlanNetmask = 0;
+    int interfaceAddressBits = 0;
+    uint32_t numAddressedNodes = 0; // 0 until setAddressPlan() is called
+
+    int findRouterIdNode(uint32_t address) const;
+
+    // bumped whenever forwarding state or endpoint attachments change, so that
+    // cached forwarding decisions in the nodes become stale
+    uint64_t forwardingEpoch = 1;
+    void invalidateForwardingDecisions() { forwardingEpoch++; }
 
 public:
     virtual void establishInitialISLs();
     virtual void updateForwardingStates(simtime_t currentInterval);
+    virtual void setUpdateInterval(simtime_t interval) { updateInterval = interval; }
     virtual void generateTopologyGraph(simtime_t currentInterval);
     virtual void clearGroundStationLinks();
     virtual void addNextHopInterface(cModule* source, cModule* destination, int interfaceID);
     virtual void removeNextHopInterface(cModule* source, cModule* destination);
     virtual void addGSLinktoTopologyGraph(int gsNum, int destNum, double weight);
     virtual void fillNextHopInterfaceMap();
+    virtual int getPeerNodeNum(cGate *outputGate);
 
+    virtual void setAddressPlan(Ipv4Address base, Ipv4Address netmask);
+    virtual Ipv4Address getInterfaceAddress(cModule *node, int interfaceIndex);
     virtual int getModuleIdFromIpAddress(int address);
     virtual void addIpAddressMap(int address, std::string modName);
     virtual void eraseIpAddressMap(int address);
@@ -114,14 +306,93 @@ public:
 
     virtual int getNodeTypeCode(int modId);
 
+    virtual LeoIpv4 *getIpv4Module(int nodeNum);
+    virtual void clearForwardingTables();
+    virtual void rotateForwardingTables();
+
+    // Computes and installs the routes of every node towards destinationNodeNum if
+    // lazy routing has not done so in this interval yet; returns true if it did
+    virtual bool routeOnDemand(int destinationNodeNum);
+
+    // Fills path with the nodes after nodeNum on the current shortest path to
+    // destinationNodeNum, the destination included; false if it is unreachable
+    virtual bool getSourceRoute(int nodeNum, int destinationNodeNum, std::vector<int>& path);
+
+    // Fills path with the nodes from sourceNodeNum to destinationNodeNum on the
+    // shortest path at time t and returns its delay in ms, or infinity if there
+    // is none. Only the topology of the current interval is known, so t must lie
+    // between its start and now.
+    virtual double queryRoute(int sourceNodeNum, int destinationNodeNum, simtime_t t, std::vector<int>& path);
+    virtual void reportForwardingTableMemory();
+
     virtual void setIpv4NodeIds();
 
+    // Failure injection: the interfaces are taken down at once, so nodes switch to
+    // their loop-free alternates, and the failure is routed around from the next interval
+    virtual void injectNodeFailure(int nodeNum);
+    virtual void injectLinkFailure(int nodeNum, int neighbourNum);
+    virtual void repairFailures();
+
     virtual void setGroundStationsWithEndpoints();
 
     virtual int getTotalEndpoints(int nodeId);
 
     virtual int getEndpointAttachmentInterfaceId(int nodeId);
     virtual int getEndpointUplinkInterfaceId(int nodeId);
+
+    // Per-packet lookups, plain bit operations and array reads
+    uint64_t getForwardingEpoch() const { return forwardingEpoch; }
+    unsigned int getRoutingEpoch() const { return routingEpoch; }
+    simtime_t getRoutingEpochStart() const { return routingEpochStart; }
+    simtime_t getInFlightWindow() const { return inFlightWindow; }
+    bool isSourceRouting() const { return sourceRouting; }
+    // Number of ranks that are loop-free alternates; the second rank of an
+    // edge-disjoint pair is not guaranteed to be closer to the destination
+    int getNumLoopFreeRanks() const { return edgeDisjointKPaths ? 1 : numOfNextHops; }
+
+    // Interface IDs of the previous epoch's tables can be reused by another link
+    // since; returns the interface that reaches the same neighbour now, or -1 if it
+    // is no longer connected. IDs the previous epoch did not know are returned as is.
+    int resolvePreviousEpochInterface(int nodeNum, int interfaceId) const
+    {
+        if (nodeNum < 0 || nodeNum >= previousNeighbourInterfaces.getNumNodes())
+            return interfaceId;
+        for (const LeoNeighbourInterfaceMap::Entry& entry : previousNeighbourInterfaces.getNeighbours(nodeNum)) {
+            if (entry.second == interfaceId)
+                return neighbourInterfaces.getInterfaceId(nodeNum, entry.first);
+        }
+        return interfaceId;
+    }
+    int getNeighbourInterfaceId(int nodeNum, int neighbourNum) const { return neighbourInterfaces.getInterfaceId(nodeNum, neighbourNum); }
+
+    // With lazyRouteLoading, installs the routes of nodeNum for the current interval before its first lookup
+    void ensureNodeRoutes(int nodeNum)
+    {
+        if (nodeNum >= 0 && nodeNum < (int)nodeRouteEntries.size() && nodeRouteEntries[nodeNum] != loadedRouteEntry)
+            materializeNodeRoutes(nodeNum);
+    }
+
+    int getNodeIdFromAddress(uint32_t address) const
+    {
+        if ((address & addressPlanNetmask) == addressPlanBase) {
+            const uint32_t nodeId = (address & ~addressPlanNetmask) >> interfaceAddressBits;
+            if (nodeId < numAddressedNodes)
+                return nodeId;
+        }
+        return findRouterIdNode(address);
+    }
+
+    // 0 = sat, 1 = gs, 2 = endpoint, -1 = unknown
+    int getNodeType(int nodeId) const
+    {
+        if (nodeId < 0 || nodeId >= (int)nodeModules.size())
+            return -1;
+        return nodeId < (int)numOfSats ? 0 : nodeId < (int)(numOfSats + numOfGS) ? 1 : 2;
+    }
+
+    int getAttachedNode(int endpoint) const { return endpoint >= 0 && endpoint < (int)endpointAttachedNodes.size() ? endpointAttachedNodes[endpoint] : -1; }
+    int getAttachmentInterface(int endpoint) const { return endpoint >= 0 && endpoint < (int)endpointAttachmentInterfaceIds.size() ? endpointAttachmentInterfaceIds[endpoint] : -1; }
+    int getUplinkInterface(int endpoint) const { return endpoint >= 0 && endpoint < (int)endpointUplinkInterfaceIds.size() ? endpointUplinkInterfaceIds[endpoint] : -1; }
 };
 }
 #endif /* NETWORKLAYER_CONFIGURATOR_IPV4_LEOIPV4NETWORKCONFIGURATOR_H_ */
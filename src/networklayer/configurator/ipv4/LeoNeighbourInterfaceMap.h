@@ -0,0 +1,83 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef NETWORKLAYER_CONFIGURATOR_IPV4_LEONEIGHBOURINTERFACEMAP_H_
+#define NETWORKLAYER_CONFIGURATOR_IPV4_LEONEIGHBOURINTERFACEMAP_H_
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace inet {
+
+//-----------------------------------------------------
+// Class: LeoNeighbourInterfaceMap
+//
+// Interface ID used by each node to reach each of its direct neighbours. A
+// satellite only has its ISLs and a few ground links, so every node keeps a
+// small vector of (neighbour, interface ID) pairs sorted by neighbour instead
+// of a row of a V x V matrix.
+//-----------------------------------------------------
+class LeoNeighbourInterfaceMap
+{
+  public:
+    typedef std::pair<int, int> Entry; // neighbour node ID, interface ID
+
+    void reset(int numNodes) { entries.assign(numNodes, std::vector<Entry>()); }
+    int getNumNodes() const { return entries.size(); }
+
+    // Returns the interface ID of node towards neighbour, or -1 if they are not connected
+    int getInterfaceId(int node, int neighbour) const
+    {
+        if (node < 0 || node >= (int)entries.size())
+            return -1;
+        const std::vector<Entry>& row = entries[node];
+        auto it = findNeighbour(row, neighbour);
+        return it != row.end() && it->first == neighbour ? it->second : -1;
+    }
+
+    void setInterfaceId(int node, int neighbour, int interfaceId)
+    {
+        std::vector<Entry>& row = entries[node];
+        auto it = findNeighbour(row, neighbour);
+        if (it != row.end() && it->first == neighbour)
+            it->second = interfaceId;
+        else
+            row.insert(it, Entry(neighbour, interfaceId));
+    }
+
+    void removeInterfaceId(int node, int neighbour)
+    {
+        std::vector<Entry>& row = entries[node];
+        auto it = findNeighbour(row, neighbour);
+        if (it != row.end() && it->first == neighbour)
+            row.erase(it);
+    }
+
+    const std::vector<Entry>& getNeighbours(int node) const { return entries[node]; }
+
+  protected:
+    template <typename Row>
+    static auto findNeighbour(Row& row, int neighbour) -> decltype(row.begin())
+    {
+        return std::lower_bound(row.begin(), row.end(), neighbour, [](const Entry& entry, int node) { return entry.first < node; });
+    }
+
+    std::vector<std::vector<Entry>> entries;
+};
+
+} // namespace inet
+
+#endif /* NETWORKLAYER_CONFIGURATOR_IPV4_LEONEIGHBOURINTERFACEMAP_H_ */
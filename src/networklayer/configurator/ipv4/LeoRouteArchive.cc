@@ -0,0 +1,291 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#include "LeoRouteArchive.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <zlib.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace inet {
+
+bool LeoRouteArchive::open(const std::string& path)
+{
+    close();
+#ifdef _WIN32
+    std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+        return false;
+    contents.resize(file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read(reinterpret_cast<char *>(contents.data()), contents.size());
+    if (file.fail() || contents.empty())
+        return false;
+    data = contents.data();
+    size = contents.size();
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat status;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && status.st_size > 0)
+        mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+    data = static_cast<const uint8_t *>(mapping);
+    size = status.st_size;
+#endif
+
+    LeoRouteArchiveHeader header;
+    bool valid = size >= sizeof(header);
+    if (valid) {
+        memcpy(&header, data, sizeof(header));
+        valid = header.magic == LEO_ROUTE_ARCHIVE_MAGIC && header.version == LEO_ROUTE_ARCHIVE_VERSION
+                && header.indexOffset >= sizeof(header) && header.indexOffset <= size
+                && header.numIntervals <= (size - header.indexOffset) / sizeof(LeoRouteArchiveEntry)
+                && header.indexOffset % alignof(LeoRouteArchiveEntry) == 0;
+    }
+    if (valid) {
+        index = reinterpret_cast<const LeoRouteArchiveEntry *>(data + header.indexOffset);
+        numIntervals = header.numIntervals;
+        for (size_t i = 0; i < numIntervals && valid; i++) {
+            const LeoRouteArchiveEntry& entry = index[i];
+            valid = entry.offset >= sizeof(header) && entry.offset <= header.indexOffset && entry.size <= header.indexOffset - entry.offset
+                    && (i == 0 || index[i - 1].interval < entry.interval) && entry.rawSize <= UINT32_MAX
+                    && (entry.base == LEO_ROUTE_KEYFRAME || (i > 0 && entry.base == index[i - 1].interval));
+        }
+    }
+    if (!valid)
+        close();
+    return valid;
+}
+
+void LeoRouteArchive::close()
+{
+#ifdef _WIN32
+    contents.clear();
+    contents.shrink_to_fit();
+#else
+    if (data != nullptr)
+        munmap(const_cast<uint8_t *>(data), size);
+#endif
+    data = nullptr;
+    size = 0;
+    index = nullptr;
+    numIntervals = 0;
+}
+
+const LeoRouteArchiveEntry *LeoRouteArchive::find(int64_t interval) const
+{
+    const LeoRouteArchiveEntry *it = findFrom(interval);
+    return it != nullptr && it->interval == interval ? it : nullptr;
+}
+
+const LeoRouteArchiveEntry *LeoRouteArchive::findFrom(int64_t interval) const
+{
+    const LeoRouteArchiveEntry *end = index + numIntervals;
+    const LeoRouteArchiveEntry *it = std::lower_bound(index, end, interval,
+            [](const LeoRouteArchiveEntry& entry, int64_t value) { return entry.interval < value; });
+    return it != end ? it : nullptr;
+}
+
+size_t LeoRouteArchive::findKeyframe(size_t entryNum) const
+{
+    // open() made sure that the first entry is one
+    while (entryNum > 0 && index[entryNum].base != LEO_ROUTE_KEYFRAME)
+        entryNum--;
+    return entryNum;
+}
+
+bool LeoRouteArchive::getRouteFile(const LeoRouteArchiveEntry& entry, std::vector<uint8_t>& buffer, const uint8_t *& data, size_t& size) const
+{
+    if (entry.rawSize == 0) {
+        data = this->data + entry.offset;
+        size = entry.size;
+        return true;
+    }
+    buffer.resize(entry.rawSize);
+    uLongf rawSize = entry.rawSize;
+    if (uncompress(buffer.data(), &rawSize, this->data + entry.offset, entry.size) != Z_OK || rawSize != entry.rawSize)
+        return false;
+    data = buffer.data();
+    size = buffer.size();
+    return true;
+}
+
+bool LeoRouteArchive::decodeRoutes(int64_t interval, LeoDecodedRoutes& routes, std::vector<uint8_t>& buffer, std::string& error) const
+{
+    const LeoRouteArchiveEntry *target = find(interval);
+    if (target == nullptr) {
+        error = "no routes for raw interval " + std::to_string(interval);
+        return false;
+    }
+    const size_t last = target - index;
+    const size_t keyframe = findKeyframe(last);
+    size_t next = keyframe;
+    if (routes.interval != LEO_ROUTE_KEYFRAME && routes.interval <= interval) {
+        const LeoRouteArchiveEntry *held = find(routes.interval);
+        if (held != nullptr && (size_t)(held - index) >= keyframe)
+            next = held - index + 1;
+    }
+    if (next == keyframe)
+        routes.interval = LEO_ROUTE_KEYFRAME;
+    int numDecoded = 0;
+    for (; next <= last; next++) {
+        const uint8_t *data;
+        size_t size;
+        if (!getRouteFile(index[next], buffer, data, size)) {
+            error = "cannot decompress raw interval " + std::to_string(index[next].interval);
+            return false;
+        }
+        if (!decodeRouteFile(data, size, routes, error))
+            return false;
+        numDecoded++;
+    }
+    if (routes.interval != interval) {
+        error = "no routes for raw interval " + std::to_string(interval);
+        return false;
+    }
+    if (numDecoded == 0) {
+        routes.changes.clear();
+        routes.nodeChanges.assign(routes.state.getNumNodes() + 1, 0);
+        routes.changesBase = interval;
+    }
+    else if (numDecoded > 1)
+        routes.changesBase = LEO_ROUTE_KEYFRAME; // the changes only cover the last entry decoded
+    return true;
+}
+
+bool LeoRouteArchiveWriter::open(const std::string& path, int compressionLevel, int keyframeSpacing)
+{
+    // The header is rewritten by close(), once the index position is known
+    close();
+    this->compressionLevel = compressionLevel;
+    this->keyframeSpacing = std::max(keyframeSpacing, 1);
+    index.clear();
+    lastInterval = writtenInterval = LEO_ROUTE_KEYFRAME;
+    pending = stopping = failed = false;
+    out.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    const LeoRouteArchiveHeader header = {LEO_ROUTE_ARCHIVE_MAGIC, LEO_ROUTE_ARCHIVE_VERSION, 0, 0};
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    position = sizeof(header);
+    if (!out.good()) {
+        // no writer thread was started, close() must not wait for one
+        out.close();
+        return false;
+    }
+    writer = std::thread(&LeoRouteArchiveWriter::run, this);
+    return true;
+}
+
+bool LeoRouteArchiveWriter::append(int64_t interval, const LeoRouteState& state)
+{
+    if (!out.is_open() || interval <= lastInterval)
+        return false;
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]() { return !pending; });
+    if (failed)
+        return false;
+    pendingState = state;
+    pendingInterval = lastInterval = interval;
+    pending = true;
+    changed.notify_all();
+    return true;
+}
+
+void LeoRouteArchiveWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [this]() { return pending || stopping; });
+        if (!pending)
+            return;
+        lock.unlock();
+        // Encoding needs pendingState, so append() waits for it; compressing and
+        // writing only use the encoded block and overlap with the next interval
+        // index is only appended to by this thread
+        const bool keyframe = writtenInterval == LEO_ROUTE_KEYFRAME || index.size() % keyframeSpacing == 0;
+        const LeoRouteFileHeader header = {LEO_ROUTE_FILE_MAGIC, LEO_ROUTE_FILE_VERSION, pendingInterval, keyframe ? LEO_ROUTE_KEYFRAME : writtenInterval};
+        routeFile.assign(reinterpret_cast<const uint8_t *>(&header), reinterpret_cast<const uint8_t *>(&header) + sizeof(header));
+        encodeRouteBlock(pendingState, keyframe ? nullptr : &writtenState, routeFile);
+        std::swap(writtenState, pendingState);
+        writtenInterval = header.interval;
+        writtenBase = header.base;
+        lock.lock();
+        pending = false;
+        changed.notify_all();
+        lock.unlock();
+        writeRouteFile();
+        lock.lock();
+        if (!out.good())
+            failed = true;
+    }
+}
+
+void LeoRouteArchiveWriter::writeRouteFile()
+{
+    LeoRouteArchiveEntry entry = {writtenInterval, position, routeFile.size(), 0, writtenBase};
+    const uint8_t *data = routeFile.data();
+    if (compressionLevel > 0) {
+        uLongf compressedSize = compressBound(routeFile.size());
+        compressed.resize(compressedSize);
+        if (compress2(compressed.data(), &compressedSize, routeFile.data(), routeFile.size(), compressionLevel) == Z_OK && compressedSize < routeFile.size()) {
+            entry.size = compressedSize;
+            entry.rawSize = routeFile.size();
+            data = compressed.data();
+        }
+    }
+    out.write(reinterpret_cast<const char *>(data), entry.size);
+    position += entry.size;
+    index.push_back(entry);
+}
+
+bool LeoRouteArchiveWriter::close()
+{
+    if (!out.is_open())
+        return true;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        changed.notify_all();
+    }
+    if (writer.joinable())
+        writer.join();
+    // Pad so that the index can be read in place from the mapping
+    const uint64_t padding = (alignof(LeoRouteArchiveEntry) - position % alignof(LeoRouteArchiveEntry)) % alignof(LeoRouteArchiveEntry);
+    const char zeros[alignof(LeoRouteArchiveEntry)] = {};
+    out.write(zeros, padding);
+    const LeoRouteArchiveHeader header = {LEO_ROUTE_ARCHIVE_MAGIC, LEO_ROUTE_ARCHIVE_VERSION, index.size(), position + padding};
+    out.write(reinterpret_cast<const char *>(index.data()), index.size() * sizeof(LeoRouteArchiveEntry));
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    const bool written = out.good() && !failed;
+    out.close();
+    index.clear();
+    writtenState = LeoRouteState();
+    return written;
+}
+
+} // namespace inet
@@ -0,0 +1,166 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef NETWORKLAYER_CONFIGURATOR_IPV4_LEOROUTEARCHIVE_H_
+#define NETWORKLAYER_CONFIGURATOR_IPV4_LEOROUTEARCHIVE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LeoRouteFile.h"
+
+namespace inet {
+
+constexpr int32_t LEO_ROUTE_ARCHIVE_MAGIC = 0x4c454f41;   // "LEOA"
+constexpr int32_t LEO_ROUTE_ARCHIVE_VERSION = 3;
+constexpr const char *LEO_ROUTE_ARCHIVE_NAME = "routes.leoa"; // in the folder of the configuration
+constexpr int LEO_ROUTE_KEYFRAME_SPACING = 64; // intervals per full route file
+
+// An archive holds the route files of every interval of one constellation
+// configuration back to back, followed by an index sorted by interval:
+//   LeoRouteArchiveHeader
+//   route files (LeoRouteFileHeader + route block), one per interval,
+//     each optionally zlib compressed
+//   LeoRouteArchiveEntry index[numIntervals]
+struct LeoRouteArchiveHeader
+{
+    int32_t magic;
+    int32_t version;
+    uint64_t numIntervals;
+    uint64_t indexOffset;
+};
+
+struct LeoRouteArchiveEntry
+{
+    int64_t interval; // raw simtime
+    uint64_t offset;  // of the route file, from the start of the archive
+    uint64_t size;    // as stored
+    uint64_t rawSize; // after decompression, 0 if stored uncompressed
+    int64_t base;     // as in the route file header, LEO_ROUTE_KEYFRAME for full routes
+};
+
+//-----------------------------------------------------
+// Class: LeoRouteArchive
+//
+// Read-only view of a route archive. The file is memory mapped once, so the
+// route file of an interval is decoded straight from the mapping unless it
+// was stored compressed.
+//-----------------------------------------------------
+class LeoRouteArchive
+{
+  public:
+    LeoRouteArchive() {}
+    LeoRouteArchive(const LeoRouteArchive&) = delete;
+    LeoRouteArchive& operator=(const LeoRouteArchive&) = delete;
+    ~LeoRouteArchive() { close(); }
+
+    // Returns false if the file cannot be mapped or its header or index is corrupt
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+
+    size_t getNumIntervals() const { return numIntervals; }
+    const LeoRouteArchiveEntry *getEntries() const { return index; }
+    // Returns nullptr if the archive holds no routes for the interval
+    const LeoRouteArchiveEntry *find(int64_t interval) const;
+    // First entry at or after interval, nullptr if there is none
+    const LeoRouteArchiveEntry *findFrom(int64_t interval) const;
+    // Number of the last keyframe entry at or before entryNum
+    size_t findKeyframe(size_t entryNum) const;
+    // Points data at the route file of entry, which is decompressed into buffer
+    // if needed. Returns false if decompression fails.
+    bool getRouteFile(const LeoRouteArchiveEntry& entry, std::vector<uint8_t>& buffer, const uint8_t *& data, size_t& size) const;
+    // Decodes the routes of interval on top of routes. Continues after the
+    // interval routes hold, or starts over at the nearest keyframe before the
+    // interval if that is closer or routes are ahead or unknown, and decodes the
+    // entries in between on the way.
+    // Returns false and sets error if an entry is corrupt or interval is missing.
+    bool decodeRoutes(int64_t interval, LeoDecodedRoutes& routes, std::vector<uint8_t>& buffer, std::string& error) const;
+
+  protected:
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    const LeoRouteArchiveEntry *index = nullptr;
+    size_t numIntervals = 0;
+#ifdef _WIN32
+    std::vector<uint8_t> contents; // no mapping, the file is read at once
+#endif
+};
+
+//-----------------------------------------------------
+// Class: LeoRouteArchiveWriter
+//
+// Writes the routes of consecutive intervals to a route archive. append()
+// only copies the state; a writer thread encodes it as the difference to the
+// interval before, compresses and writes it, so that the next interval can be
+// computed in the meantime. Every keyframeSpacing-th interval is written in
+// full, so readers never decode more than that many entries to reach one.
+// close() writes the index and the final header.
+//-----------------------------------------------------
+class LeoRouteArchiveWriter
+{
+  public:
+    LeoRouteArchiveWriter() {}
+    LeoRouteArchiveWriter(const LeoRouteArchiveWriter&) = delete;
+    LeoRouteArchiveWriter& operator=(const LeoRouteArchiveWriter&) = delete;
+    ~LeoRouteArchiveWriter() { close(); }
+
+    // compressionLevel is a zlib level from 1 to 9, 0 stores the intervals uncompressed
+    bool open(const std::string& path, int compressionLevel = 0, int keyframeSpacing = LEO_ROUTE_KEYFRAME_SPACING);
+    // Intervals (raw simtime) must be appended in increasing order. Waits while
+    // the writer thread still encodes the interval before. Returns false if
+    // writing an earlier interval failed.
+    bool append(int64_t interval, const LeoRouteState& state);
+    bool close();
+    bool isOpen() const { return out.is_open(); }
+
+  protected:
+    void run();
+    void writeRouteFile();
+
+    std::ofstream out;
+    int compressionLevel = 0;
+    int keyframeSpacing = LEO_ROUTE_KEYFRAME_SPACING;
+    uint64_t position = 0;
+    std::vector<LeoRouteArchiveEntry> index;
+    int64_t lastInterval = LEO_ROUTE_KEYFRAME;
+
+    // handed from append() to the writer thread
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool pending = false; // pendingState is owned by the writer thread while set
+    bool stopping = false;
+    bool failed = false;
+    int64_t pendingInterval = LEO_ROUTE_KEYFRAME;
+    LeoRouteState pendingState;
+
+    // only used by the writer thread
+    LeoRouteState writtenState;
+    int64_t writtenInterval = LEO_ROUTE_KEYFRAME;
+    int64_t writtenBase = LEO_ROUTE_KEYFRAME;
+    std::vector<uint8_t> routeFile;
+    std::vector<uint8_t> compressed;
+};
+
+} // namespace inet
+
+#endif /* NETWORKLAYER_CONFIGURATOR_IPV4_LEOROUTEARCHIVE_H_ */
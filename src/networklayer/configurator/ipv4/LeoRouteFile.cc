@@ -0,0 +1,231 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#include "LeoRouteFile.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace inet {
+
+namespace {
+
+const size_t BLOCK_HEADER_SIZE = 4 * sizeof(uint32_t);
+const uint32_t BLOCK_FLAG_KEYFRAME = 1;
+
+void writeUint32(std::vector<uint8_t>& out, size_t pos, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        out[pos + i] = (uint8_t)(value >> (8 * i));
+}
+
+uint32_t readUint32(const uint8_t *data)
+{
+    return (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+void writeVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+uint64_t encodeNextHop(int32_t nextHop)
+{
+    if (nextHop == LeoRouteState::NO_ROUTE)
+        return 0;
+    const uint64_t node = nextHop & ~LeoRouteState::EQUAL_COST_FLAG;
+    return (node << 1 | ((nextHop & LeoRouteState::EQUAL_COST_FLAG) ? 1 : 0)) + 1;
+}
+
+}
+
+void LeoRouteState::reset(int numNodes, int numRanks, int numDestinations)
+{
+    this->numNodes = numNodes;
+    this->numRanks = numRanks;
+    this->numDestinations = numDestinations;
+    entries.assign((size_t)numNodes * numRanks * numDestinations, NO_ROUTE);
+}
+
+void LeoRouteState::clear()
+{
+    std::fill(entries.begin(), entries.end(), NO_ROUTE);
+}
+
+void LeoRouteState::clearNode(int node)
+{
+    const size_t nodeEntries = (size_t)numRanks * numDestinations;
+    std::fill(entries.begin() + node * nodeEntries, entries.begin() + (node + 1) * nodeEntries, NO_ROUTE);
+}
+
+void encodeRouteBlock(const LeoRouteState& current, const LeoRouteState *previous, std::vector<uint8_t>& block)
+{
+    const int numNodes = current.getNumNodes();
+    const size_t nodeEntries = (size_t)current.getNumRanks() * current.getNumDestinations();
+    const size_t blockStart = block.size();
+    const size_t offsetsStart = blockStart + BLOCK_HEADER_SIZE;
+    const size_t payloadStart = offsetsStart + (numNodes + 1) * sizeof(uint32_t);
+    block.resize(payloadStart);
+    writeUint32(block, blockStart, numNodes);
+    writeUint32(block, blockStart + 4, current.getNumRanks());
+    writeUint32(block, blockStart + 8, current.getNumDestinations());
+    writeUint32(block, blockStart + 12, previous == nullptr ? BLOCK_FLAG_KEYFRAME : 0);
+
+    std::vector<uint32_t> changedKeys;
+    for (int node = 0; node < numNodes; node++) {
+        writeUint32(block, offsetsStart + node * sizeof(uint32_t), block.size() - payloadStart);
+        const int32_t *entries = current.getNodeEntries(node);
+        const int32_t *previousEntries = previous != nullptr ? previous->getNodeEntries(node) : nullptr;
+        changedKeys.clear();
+        for (size_t key = 0; key < nodeEntries; key++) {
+            if (entries[key] != (previousEntries != nullptr ? previousEntries[key] : LeoRouteState::NO_ROUTE))
+                changedKeys.push_back(key);
+        }
+        writeVarint(block, changedKeys.size());
+        int64_t previousKey = -1;
+        for (uint32_t key : changedKeys) {
+            writeVarint(block, key - previousKey - 1);
+            writeVarint(block, encodeNextHop(entries[key]));
+            previousKey = key;
+        }
+    }
+    writeUint32(block, offsetsStart + numNodes * sizeof(uint32_t), block.size() - payloadStart);
+}
+
+bool LeoRouteBlockReader::open(const uint8_t *data, size_t size)
+{
+    if (size < BLOCK_HEADER_SIZE)
+        return false;
+    numNodes = readUint32(data);
+    numRanks = readUint32(data + 4);
+    numDestinations = readUint32(data + 8);
+    keyframe = (readUint32(data + 12) & BLOCK_FLAG_KEYFRAME) != 0;
+    if (numNodes < 0 || numRanks < 0 || numDestinations < 0)
+        return false;
+    const size_t payloadStart = BLOCK_HEADER_SIZE + ((size_t)numNodes + 1) * sizeof(uint32_t);
+    if (size < payloadStart)
+        return false;
+    offsets = data + BLOCK_HEADER_SIZE;
+    payload = data + payloadStart;
+    uint32_t previousOffset = 0;
+    for (int node = 0; node <= numNodes; node++) {
+        const uint32_t offset = readOffset(node);
+        if (offset < previousOffset)
+            return false;
+        previousOffset = offset;
+    }
+    blockSize = payloadStart + previousOffset;
+    return blockSize <= size;
+}
+
+uint32_t LeoRouteBlockReader::readOffset(int node) const
+{
+    return readUint32(offsets + node * sizeof(uint32_t));
+}
+
+bool LeoRouteBlockReader::readVarint(const uint8_t *& pos, const uint8_t *end, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos == end)
+            return false;
+        const uint8_t byte = *pos++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool LeoRouteBlockReader::apply(int node, LeoRouteState& state) const
+{
+    return forEachChange(node, [&](int rank, int destination, int32_t nextHop) {
+        state.set(node, rank, destination, nextHop);
+    });
+}
+
+bool LeoRouteBlockReader::apply(LeoRouteState& state) const
+{
+    if (state.getNumNodes() != numNodes || state.getNumRanks() != numRanks || state.getNumDestinations() != numDestinations)
+        return false;
+    if (keyframe)
+        state.clear();
+    for (int node = 0; node < numNodes; node++) {
+        if (!apply(node, state))
+            return false;
+    }
+    return true;
+}
+
+bool decodeRouteFile(const uint8_t *data, size_t size, LeoDecodedRoutes& routes, std::string& error)
+{
+    LeoRouteFileHeader header;
+    if (size < sizeof(header)) {
+        error = "truncated route file";
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != LEO_ROUTE_FILE_MAGIC || header.version != LEO_ROUTE_FILE_VERSION) {
+        error = "unsupported route file version " + std::to_string(header.version);
+        return false;
+    }
+    LeoRouteBlockReader block;
+    if (!block.open(data + sizeof(header), size - sizeof(header))) {
+        error = "corrupt route block";
+        return false;
+    }
+    if ((header.base == LEO_ROUTE_KEYFRAME) != block.isKeyframe()) {
+        error = "route file header and route block disagree on whether the interval is a keyframe";
+        return false;
+    }
+    if (!block.isKeyframe() && header.base != routes.interval) {
+        error = "delta against raw interval " + std::to_string(header.base) + ", which was not decoded before it";
+        return false;
+    }
+    LeoRouteState& state = routes.state;
+    if (block.isKeyframe() || state.getNumNodes() != block.getNumNodes() || state.getNumRanks() != block.getNumRanks()
+            || state.getNumDestinations() != block.getNumDestinations()) {
+        if (!block.isKeyframe()) {
+            error = "route block dimensions differ from the interval before";
+            return false;
+        }
+        state.reset(block.getNumNodes(), block.getNumRanks(), block.getNumDestinations());
+    }
+
+    routes.changes.clear();
+    routes.nodeChanges.assign(1, 0);
+    for (int node = 0; node < block.getNumNodes(); node++) {
+        const bool valid = block.forEachChange(node, [&](int rank, int destination, int32_t nextHop) {
+            state.set(node, rank, destination, nextHop);
+            routes.changes.push_back({node, rank, destination, nextHop});
+        });
+        if (!valid) {
+            error = "corrupt routes of node " + std::to_string(node);
+            routes.interval = LEO_ROUTE_KEYFRAME;
+            return false;
+        }
+        routes.nodeChanges.push_back(routes.changes.size());
+    }
+    routes.interval = header.interval;
+    routes.keyframe = block.isKeyframe();
+    routes.changesBase = header.base;
+    return true;
+}
+
+} // namespace inet
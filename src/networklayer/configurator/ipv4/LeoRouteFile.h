@@ -0,0 +1,179 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef NETWORKLAYER_CONFIGURATOR_IPV4_LEOROUTEFILE_H_
+#define NETWORKLAYER_CONFIGURATOR_IPV4_LEOROUTEFILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace inet {
+
+constexpr int32_t LEO_ROUTE_FILE_MAGIC = 0x4c454f33;   // "LEO3"
+constexpr int32_t LEO_ROUTE_FILE_VERSION = 3;
+constexpr int64_t LEO_ROUTE_KEYFRAME = -1; // base interval of a block holding the full state
+
+// Header of a version 3 route file, followed by one route block. Intervals are
+// raw simtime values; base is the interval the block is a delta against.
+struct LeoRouteFileHeader
+{
+    int32_t magic;
+    int32_t version;
+    int64_t interval;
+    int64_t base;
+};
+
+//-----------------------------------------------------
+// Class: LeoRouteState
+//
+// Next hops of every routable node for one interval, laid out as
+// [node][rank][destination]. An entry is the next hop node ID, with
+// EQUAL_COST_FLAG set for equal cost alternatives, or NO_ROUTE. Route files
+// store the difference between the states of consecutive intervals.
+//-----------------------------------------------------
+class LeoRouteState
+{
+  public:
+    static constexpr int32_t NO_ROUTE = -1;
+    static constexpr int32_t EQUAL_COST_FLAG = 1 << 30;
+
+    void reset(int numNodes, int numRanks, int numDestinations);
+    void clear();
+    void clearNode(int node);
+
+    int getNumNodes() const { return numNodes; }
+    int getNumRanks() const { return numRanks; }
+    int getNumDestinations() const { return numDestinations; }
+    bool isEmpty() const { return entries.empty(); }
+
+    // rank is 0 based
+    int32_t get(int node, int rank, int destination) const { return entries[index(node, rank, destination)]; }
+    void set(int node, int rank, int destination, int32_t nextHop) { entries[index(node, rank, destination)] = nextHop; }
+    const int32_t *getNodeEntries(int node) const { return entries.data() + (size_t)node * numRanks * numDestinations; }
+
+  protected:
+    size_t index(int node, int rank, int destination) const { return ((size_t)node * numRanks + rank) * numDestinations + destination; }
+
+    int numNodes = 0;
+    int numRanks = 0;
+    int numDestinations = 0;
+    std::vector<int32_t> entries;
+};
+
+// Appends the route block of current to block. Without previous the block holds
+// every route (keyframe), otherwise only the entries that differ from previous.
+//
+// Block layout, all integers little endian:
+//   uint32 numNodes, numRanks, numDestinations, flags (1 = keyframe)
+//   uint32 offsets[numNodes + 1], start of each node section in the payload
+//   payload, one section per node: varint count, then count changes of
+//     varint key delta (key = rank * numDestinations + destination, stored as
+//     the distance to the previous key minus one) and
+//     varint value (0 = no route, else (nextHop << 1 | equalCost) + 1)
+void encodeRouteBlock(const LeoRouteState& current, const LeoRouteState *previous, std::vector<uint8_t>& block);
+
+//-----------------------------------------------------
+// Class: LeoRouteBlockReader
+//
+// Decodes a route block in place. The per-node offsets let a reader decode the
+// changes of single nodes without touching the rest of the block.
+//-----------------------------------------------------
+class LeoRouteBlockReader
+{
+  public:
+    // Returns false if the block is truncated or its offsets are inconsistent
+    bool open(const uint8_t *data, size_t size);
+
+    int getNumNodes() const { return numNodes; }
+    int getNumRanks() const { return numRanks; }
+    int getNumDestinations() const { return numDestinations; }
+    bool isKeyframe() const { return keyframe; }
+    size_t getBlockSize() const { return blockSize; }
+
+    // Calls fn(rank, destination, nextHop) for every changed route of node, with
+    // nextHop = LeoRouteState::NO_ROUTE for removed routes. Returns false if the
+    // node section is corrupt.
+    template <typename Fn>
+    bool forEachChange(int node, Fn&& fn) const
+    {
+        const uint8_t *pos = payload + readOffset(node);
+        const uint8_t *end = payload + readOffset(node + 1);
+        uint64_t count;
+        if (!readVarint(pos, end, count))
+            return false;
+        int64_t key = -1;
+        const int64_t numKeys = (int64_t)numRanks * numDestinations;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t keyDelta, value;
+            if (!readVarint(pos, end, keyDelta) || !readVarint(pos, end, value))
+                return false;
+            // checked before adding, a huge delta would wrap key negative
+            if (keyDelta >= (uint64_t)(numKeys - key - 1) || value > (uint64_t)UINT32_MAX)
+                return false;
+            key += (int64_t)keyDelta + 1;
+            const int32_t nextHop = value == 0 ? LeoRouteState::NO_ROUTE
+                    : (int32_t)((value - 1) >> 1) | (((value - 1) & 1) ? LeoRouteState::EQUAL_COST_FLAG : 0);
+            fn((int)(key / numDestinations), (int)(key % numDestinations), nextHop);
+        }
+        return true;
+    }
+
+    // Applies the changes of one node, or of all nodes, to state
+    bool apply(int node, LeoRouteState& state) const;
+    bool apply(LeoRouteState& state) const;
+
+  protected:
+    uint32_t readOffset(int node) const;
+    static bool readVarint(const uint8_t *& pos, const uint8_t *end, uint64_t& value);
+
+    const uint8_t *offsets = nullptr;
+    const uint8_t *payload = nullptr;
+    int numNodes = 0;
+    int numRanks = 0;
+    int numDestinations = 0;
+    bool keyframe = false;
+    size_t blockSize = 0;
+};
+
+struct LeoRouteChange
+{
+    int node;
+    int rank; // 0 based
+    int destination;
+    int32_t nextHop; // as in LeoRouteState
+};
+
+// Routes of the interval decoded last, together with the changes of that
+// interval so that tables holding the interval before only need those
+struct LeoDecodedRoutes
+{
+    int64_t interval = LEO_ROUTE_KEYFRAME; // raw simtime, LEO_ROUTE_KEYFRAME before the first file
+    bool keyframe = false;
+    int64_t changesBase = LEO_ROUTE_KEYFRAME; // interval the changes lead from, LEO_ROUTE_KEYFRAME if they do not cover the step from any
+    LeoRouteState state;
+    std::vector<LeoRouteChange> changes; // ordered by node
+    std::vector<size_t> nodeChanges; // first change of every node, numNodes + 1 entries
+};
+
+// Decodes the route file (header and route block) in data on top of routes,
+// which must hold the interval the file is based on unless it is a keyframe.
+// Returns false and sets error if the file is corrupt or based on another interval.
+bool decodeRouteFile(const uint8_t *data, size_t size, LeoDecodedRoutes& routes, std::string& error);
+
+} // namespace inet
+
+#endif /* NETWORKLAYER_CONFIGURATOR_IPV4_LEOROUTEFILE_H_ */
@@ -0,0 +1,54 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#include "LeoRoutePrefetcher.h"
+
+namespace inet {
+
+void LeoRoutePrefetcher::prefetch(const LeoRouteArchive& archive, int64_t interval)
+{
+    wait();
+    target = interval;
+    error.clear();
+    worker = std::thread(&LeoRoutePrefetcher::run, this, &archive);
+}
+
+void LeoRoutePrefetcher::run(const LeoRouteArchive *archive)
+{
+    archive->decodeRoutes(target, routes, buffer, error);
+}
+
+bool LeoRoutePrefetcher::take(int64_t interval, LeoDecodedRoutes& routes, std::string& error)
+{
+    if (!worker.joinable() || target != interval)
+        return false;
+    wait();
+    if (!this->error.empty()) {
+        error = this->error;
+        return false;
+    }
+    // Copied rather than swapped, so that the next prefetch continues from this
+    // interval and only has to decode one entry
+    routes = this->routes;
+    return true;
+}
+
+void LeoRoutePrefetcher::wait()
+{
+    if (worker.joinable())
+        worker.join();
+}
+
+} // namespace inet
@@ -0,0 +1,66 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef NETWORKLAYER_CONFIGURATOR_IPV4_LEOROUTEPREFETCHER_H_
+#define NETWORKLAYER_CONFIGURATOR_IPV4_LEOROUTEPREFETCHER_H_
+
+#include <string>
+#include <thread>
+
+#include "LeoRouteArchive.h"
+#include "LeoRouteFile.h"
+
+namespace inet {
+
+//-----------------------------------------------------
+// Class: LeoRoutePrefetcher
+//
+// Decodes the routes of the next interval from a route archive in a
+// background thread while the simulation runs the current one. At the
+// interval boundary take() hands the decoded routes over by swapping them
+// with the caller's, so only installing the changes remains to be done.
+//-----------------------------------------------------
+class LeoRoutePrefetcher
+{
+  public:
+    LeoRoutePrefetcher() {}
+    LeoRoutePrefetcher(const LeoRoutePrefetcher&) = delete;
+    LeoRoutePrefetcher& operator=(const LeoRoutePrefetcher&) = delete;
+    ~LeoRoutePrefetcher() { wait(); }
+
+    // Starts decoding interval (raw simtime). The thread continues from the
+    // interval its routes hold and decodes the archive entries in between on
+    // the way; archive must stay open until take() or wait() returned.
+    void prefetch(const LeoRouteArchive& archive, int64_t interval);
+
+    // Waits for the running prefetch. If it decoded interval, its routes are
+    // copied to routes and true is returned. error is set if it failed.
+    bool take(int64_t interval, LeoDecodedRoutes& routes, std::string& error);
+
+    void wait();
+
+  protected:
+    void run(const LeoRouteArchive *archive);
+
+    std::thread worker;
+    int64_t target = LEO_ROUTE_KEYFRAME;
+    LeoDecodedRoutes routes; // only accessed by the worker while it runs
+    std::string error;
+    std::vector<uint8_t> buffer; // decompressed route file
+};
+
+} // namespace inet
+
+#endif /* NETWORKLAYER_CONFIGURATOR_IPV4_LEOROUTEPREFETCHER_H_ */
@@ -0,0 +1,446 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#include "LeoRoutingGraph.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+namespace inet {
+
+namespace {
+
+typedef std::pair<double, int> HeapEntry;
+
+void pushHeap(LeoDijkstraScratch& scratch, double distance, int vertex)
+{
+    scratch.heap.emplace_back(distance, vertex);
+    std::push_heap(scratch.heap.begin(), scratch.heap.end(), std::greater<HeapEntry>());
+}
+
+HeapEntry popHeap(LeoDijkstraScratch& scratch)
+{
+    std::pop_heap(scratch.heap.begin(), scratch.heap.end(), std::greater<HeapEntry>());
+    HeapEntry entry = scratch.heap.back();
+    scratch.heap.pop_back();
+    return entry;
+}
+
+// Rebuilds tree.order from the parent pointers (breadth first from the root)
+void rebuildTreeOrder(LeoShortestPathTree& tree, int root, LeoDijkstraScratch& scratch)
+{
+    const int numVertices = tree.parent.size();
+    scratch.childOffsets.assign(numVertices + 1, 0);
+    for (int vertex = 0; vertex < numVertices; vertex++) {
+        if (tree.parent[vertex] >= 0)
+            scratch.childOffsets[tree.parent[vertex] + 1]++;
+    }
+    for (int vertex = 0; vertex < numVertices; vertex++)
+        scratch.childOffsets[vertex + 1] += scratch.childOffsets[vertex];
+    scratch.children.resize(scratch.childOffsets[numVertices]);
+    std::vector<int>& fill = tree.order; // borrowed as insertion cursor
+    fill.assign(scratch.childOffsets.begin(), scratch.childOffsets.end() - 1);
+    for (int vertex = 0; vertex < numVertices; vertex++) {
+        if (tree.parent[vertex] >= 0)
+            scratch.children[fill[tree.parent[vertex]]++] = vertex;
+    }
+
+    tree.order.clear();
+    tree.order.push_back(root);
+    for (size_t i = 0; i < tree.order.size(); i++) {
+        const int vertex = tree.order[i];
+        for (int c = scratch.childOffsets[vertex]; c < scratch.childOffsets[vertex + 1]; c++)
+            tree.order.push_back(scratch.children[c]);
+    }
+}
+
+}
+
+void LeoRoutingGraph::build(int numVertices, const std::vector<int>& edgeEndpoints, const std::vector<double>& edgeWeights)
+{
+    this->numVertices = numVertices;
+    numEdges = edgeWeights.size();
+    arcOffsets.assign(numVertices + 1, 0);
+    for (int edge = 0; edge < numEdges; edge++) {
+        arcOffsets[edgeEndpoints[2 * edge] + 1]++;
+        arcOffsets[edgeEndpoints[2 * edge + 1] + 1]++;
+    }
+    for (int vertex = 0; vertex < numVertices; vertex++)
+        arcOffsets[vertex + 1] += arcOffsets[vertex];
+
+    arcs.resize(arcOffsets[numVertices]);
+    std::vector<int> cursor(arcOffsets.begin(), arcOffsets.end() - 1);
+    for (int edge = 0; edge < numEdges; edge++) {
+        const int from = edgeEndpoints[2 * edge];
+        const int to = edgeEndpoints[2 * edge + 1];
+        arcs[cursor[from]++] = {to, edgeWeights[edge]};
+        arcs[cursor[to]++] = {from, edgeWeights[edge]};
+    }
+}
+
+double LeoRoutingGraph::getEdgeWeight(int from, int to) const
+{
+    double weight = LEO_UNREACHABLE;
+    for (const Arc *arc = arcsBegin(from); arc != arcsEnd(from); ++arc) {
+        if (arc->target == to && arc->weight < weight)
+            weight = arc->weight;
+    }
+    return weight;
+}
+
+void computeShortestPathTree(const LeoRoutingGraph& graph, int root, LeoShortestPathTree& tree, LeoDijkstraScratch& scratch)
+{
+    const int numVertices = graph.getNumVertices();
+    tree.distance.assign(numVertices, LEO_UNREACHABLE);
+    tree.parent.assign(numVertices, -1);
+    tree.order.clear();
+    scratch.heap.clear();
+
+    tree.distance[root] = 0;
+    pushHeap(scratch, 0, root);
+    while (!scratch.heap.empty()) {
+        const HeapEntry entry = popHeap(scratch);
+        const int vertex = entry.second;
+        if (entry.first > tree.distance[vertex])
+            continue;
+        tree.order.push_back(vertex);
+        for (const LeoRoutingGraph::Arc *arc = graph.arcsBegin(vertex); arc != graph.arcsEnd(vertex); ++arc) {
+            const double candidate = entry.first + arc->weight;
+            if (candidate < tree.distance[arc->target]) {
+                tree.distance[arc->target] = candidate;
+                tree.parent[arc->target] = vertex;
+                pushHeap(scratch, candidate, arc->target);
+            }
+        }
+    }
+}
+
+void diffRoutingGraphs(const LeoRoutingGraph& previous, const LeoRoutingGraph& current, std::vector<LeoEdgeChange>& changes)
+{
+    // Parallel links are compared by their cheapest weight, so each vertex pair
+    // is only looked at through its first arc
+    auto isFirstArc = [](const LeoRoutingGraph& graph, int vertex, const LeoRoutingGraph::Arc *arc) {
+        return std::none_of(graph.arcsBegin(vertex), arc, [&](const LeoRoutingGraph::Arc& other) { return other.target == arc->target; });
+    };
+
+    changes.clear();
+    const int numVertices = std::min(previous.getNumVertices(), current.getNumVertices());
+    for (int vertex = 0; vertex < numVertices; vertex++) {
+        for (const LeoRoutingGraph::Arc *arc = current.arcsBegin(vertex); arc != current.arcsEnd(vertex); ++arc) {
+            if (arc->target <= vertex || arc->target >= numVertices || !isFirstArc(current, vertex, arc))
+                continue;
+            const double oldWeight = previous.getEdgeWeight(vertex, arc->target);
+            const double newWeight = current.getEdgeWeight(vertex, arc->target);
+            if (oldWeight != newWeight)
+                changes.push_back({vertex, arc->target, oldWeight, newWeight});
+        }
+        for (const LeoRoutingGraph::Arc *arc = previous.arcsBegin(vertex); arc != previous.arcsEnd(vertex); ++arc) {
+            if (arc->target <= vertex || arc->target >= numVertices || !isFirstArc(previous, vertex, arc))
+                continue;
+            if (current.getEdgeWeight(vertex, arc->target) == LEO_UNREACHABLE)
+                changes.push_back({vertex, arc->target, previous.getEdgeWeight(vertex, arc->target), LEO_UNREACHABLE});
+        }
+    }
+}
+
+LeoTreeRepairCount repairShortestPathTree(const LeoRoutingGraph& graph, int root, const std::vector<LeoEdgeChange>& changes,
+                                          LeoShortestPathTree& tree, LeoDijkstraScratch& scratch)
+{
+    const int numVertices = graph.getNumVertices();
+    LeoTreeRepairCount count;
+    if (!tree.isValid() || static_cast<int>(tree.distance.size()) != numVertices) {
+        computeShortestPathTree(graph, root, tree, scratch);
+        count.scannedVertices = tree.order.size();
+        for (int vertex : tree.order)
+            count.scannedArcs += graph.getDegree(vertex);
+        return count;
+    }
+
+    std::vector<double>& distance = tree.distance;
+    std::vector<int>& parent = tree.parent;
+    std::vector<char>& detachedMark = scratch.marks;
+    std::vector<int>& detached = scratch.detached;
+    detachedMark.assign(numVertices, 0);
+    detached.clear();
+    scratch.heap.clear();
+    bool parentsChanged = false;
+
+    // A tree edge that became longer or disappeared detaches the subtree below it
+    bool anyDetached = false;
+    for (const LeoEdgeChange& change : changes) {
+        if (change.newWeight <= change.oldWeight)
+            continue;
+        const int child = parent[change.to] == change.from ? change.to : parent[change.from] == change.to ? change.from : -1;
+        if (child >= 0) {
+            detachedMark[child] = 1;
+            anyDetached = true;
+        }
+    }
+    if (anyDetached) {
+        // Parents come before their children in the order
+        for (size_t i = 1; i < tree.order.size(); i++) {
+            const int vertex = tree.order[i];
+            if (detachedMark[vertex] || detachedMark[parent[vertex]]) {
+                detachedMark[vertex] = 1;
+                detached.push_back(vertex);
+                distance[vertex] = LEO_UNREACHABLE;
+                parent[vertex] = -1;
+            }
+        }
+        parentsChanged = true;
+
+        // Seed every detached vertex with its best attached neighbour
+        for (int vertex : detached) {
+            count.scannedVertices++;
+            count.scannedArcs += graph.getDegree(vertex);
+            for (const LeoRoutingGraph::Arc *arc = graph.arcsBegin(vertex); arc != graph.arcsEnd(vertex); ++arc) {
+                const double candidate = distance[arc->target] + arc->weight;
+                if (!detachedMark[arc->target] && candidate < distance[vertex]) {
+                    distance[vertex] = candidate;
+                    parent[vertex] = arc->target;
+                }
+            }
+            if (distance[vertex] != LEO_UNREACHABLE)
+                pushHeap(scratch, distance[vertex], vertex);
+        }
+    }
+
+    // An edge that became shorter or appeared can only improve its endpoints
+    auto relax = [&](int from, int to, double weight) {
+        const double candidate = distance[from] + weight;
+        if (candidate < distance[to]) {
+            distance[to] = candidate;
+            parentsChanged |= parent[to] != from;
+            parent[to] = from;
+            pushHeap(scratch, candidate, to);
+        }
+    };
+    for (const LeoEdgeChange& change : changes) {
+        if (change.newWeight < change.oldWeight) {
+            relax(change.from, change.to, change.newWeight);
+            relax(change.to, change.from, change.newWeight);
+        }
+    }
+
+    while (!scratch.heap.empty()) {
+        const HeapEntry entry = popHeap(scratch);
+        const int vertex = entry.second;
+        if (entry.first > distance[vertex])
+            continue;
+        count.scannedVertices++;
+        count.scannedArcs += graph.getDegree(vertex);
+        for (const LeoRoutingGraph::Arc *arc = graph.arcsBegin(vertex); arc != graph.arcsEnd(vertex); ++arc)
+            relax(vertex, arc->target, arc->weight);
+    }
+
+    if (parentsChanged)
+        rebuildTreeOrder(tree, root, scratch);
+    return count;
+}
+
+void computeFirstHops(const LeoShortestPathTree& tree, int root, std::vector<int>& firstHop)
+{
+    firstHop.assign(tree.parent.size(), -1);
+    for (size_t i = 1; i < tree.order.size(); i++) {
+        const int vertex = tree.order[i];
+        const int parentVertex = tree.parent[vertex];
+        firstHop[vertex] = parentVertex == root ? vertex : firstHop[parentVertex];
+    }
+}
+
+void computeRankedNextHops(const LeoRoutingGraph& graph, const LeoShortestPathTree& tree, int root, int k, std::vector<int>& nextHops)
+{
+    const int numVertices = graph.getNumVertices();
+    nextHops.assign((size_t)numVertices * k, -1);
+    std::vector<std::pair<double, int>> candidates;
+    for (int vertex = 0; vertex < numVertices; vertex++) {
+        const int parentVertex = tree.parent[vertex];
+        if (vertex == root || parentVertex < 0)
+            continue;
+        int *vertexNextHops = nextHops.data() + (size_t)vertex * k;
+        vertexNextHops[0] = parentVertex;
+        if (k == 1)
+            continue;
+
+        candidates.clear();
+        for (const LeoRoutingGraph::Arc *arc = graph.arcsBegin(vertex); arc != graph.arcsEnd(vertex); ++arc) {
+            if (arc->target != parentVertex && tree.distance[arc->target] < tree.distance[vertex])
+                candidates.emplace_back(arc->weight + tree.distance[arc->target], arc->target);
+        }
+        std::sort(candidates.begin(), candidates.end());
+        int rank = 1;
+        for (size_t i = 0; i < candidates.size() && rank < k; i++) {
+            // parallel links to the same neighbour only count once
+            if (std::find(vertexNextHops, vertexNextHops + rank, candidates[i].second) == vertexNextHops + rank)
+                vertexNextHops[rank++] = candidates[i].second;
+        }
+    }
+}
+
+int computeDisjointNextHop(const LeoRoutingGraph& graph, const LeoShortestPathTree& tree, int root, int vertex, LeoDijkstraScratch& scratch)
+{
+    const int numVertices = graph.getNumVertices();
+    if (vertex == root || tree.parent[vertex] < 0)
+        return -1;
+    if ((int)scratch.residualDistance.size() != numVertices) {
+        scratch.residualDistance.assign(numVertices, LEO_UNREACHABLE);
+        scratch.residualParent.assign(numVertices, -1);
+        scratch.residualOnPath.assign(numVertices, 0);
+    }
+
+    // Mark the tree path from vertex up to root; onPath[u] means the edge
+    // (parent[u], u) belongs to the first path.
+    std::vector<char>& onPath = scratch.residualOnPath;
+    for (int u = vertex; u != root; u = tree.parent[u])
+        onPath[u] = 1;
+
+    // Dijkstra from root on the residual graph with reduced costs
+    // w(a,b) + dist(a) - dist(b), which are non-negative. Edges of the first
+    // path may only be used backwards, at zero reduced cost.
+    std::vector<double>& distance = scratch.residualDistance;
+    std::vector<int>& parent = scratch.residualParent;
+    scratch.heap.clear();
+    scratch.residualTouched.clear();
+    distance[root] = 0;
+    scratch.residualTouched.push_back(root);
+    pushHeap(scratch, 0, root);
+    while (!scratch.heap.empty()) {
+        const HeapEntry entry = popHeap(scratch);
+        const int a = entry.second;
+        if (entry.first > distance[a])
+            continue;
+        if (a == vertex)
+            break;
+        for (const LeoRoutingGraph::Arc *arc = graph.arcsBegin(a); arc != graph.arcsEnd(a); ++arc) {
+            const int b = arc->target;
+            if (tree.distance[b] == LEO_UNREACHABLE)
+                continue;
+            double reducedCost;
+            if (onPath[b] && tree.parent[b] == a)
+                continue;
+            else if (onPath[a] && tree.parent[a] == b)
+                reducedCost = 0;
+            else
+                reducedCost = std::max(0.0, arc->weight + tree.distance[a] - tree.distance[b]);
+            const double candidate = entry.first + reducedCost;
+            if (candidate < distance[b]) {
+                if (distance[b] == LEO_UNREACHABLE)
+                    scratch.residualTouched.push_back(b);
+                distance[b] = candidate;
+                parent[b] = a;
+                pushHeap(scratch, candidate, b);
+            }
+        }
+    }
+
+    // The second path cannot end with a reversed edge of the first one, so both
+    // edges at vertex survive the cancellation of opposite edges.
+    const int nextHop = distance[vertex] < LEO_UNREACHABLE ? parent[vertex] : -1;
+    for (int u : scratch.residualTouched) {
+        distance[u] = LEO_UNREACHABLE;
+        parent[u] = -1;
+    }
+    for (int u = vertex; u != root; u = tree.parent[u])
+        onPath[u] = 0;
+    return nextHop;
+}
+
+void computeDestinationNextHops(const LeoRoutingGraph& graph, const LeoShortestPathTree& tree, int root, int k, bool edgeDisjoint,
+                                double costSlack, LeoDijkstraScratch& scratch, std::vector<int>& nextHops, std::vector<char>& equalCost)
+{
+    const int numVertices = graph.getNumVertices();
+    equalCost.assign((size_t)numVertices * k, 0);
+    if (edgeDisjoint) {
+        nextHops.assign((size_t)numVertices * k, -1);
+        for (int vertex = 0; vertex < numVertices; vertex++) {
+            nextHops[(size_t)vertex * k] = vertex != root ? tree.parent[vertex] : -1;
+            nextHops[(size_t)vertex * k + 1] = computeDisjointNextHop(graph, tree, root, vertex, scratch);
+        }
+        return;
+    }
+
+    // Ranked alternatives strictly approach the root, so flows can be spread
+    // over those close to the shortest path without forming loops
+    computeRankedNextHops(graph, tree, root, k, nextHops);
+    for (int vertex = 0; vertex < numVertices; vertex++) {
+        for (int rank = 1; rank < k && nextHops[(size_t)vertex * k + rank] >= 0; rank++) {
+            const int nextHop = nextHops[(size_t)vertex * k + rank];
+            equalCost[(size_t)vertex * k + rank] = graph.getEdgeWeight(vertex, nextHop) + tree.distance[nextHop] <= tree.distance[vertex] * (1 + costSlack);
+        }
+    }
+}
+
+double computeAStarPath(const LeoRoutingGraph& graph, int source, int target, const std::vector<LeoVertexPosition>& positions,
+                        double costPerMetre, LeoDijkstraScratch& scratch, std::vector<int>& path)
+{
+    const int numVertices = graph.getNumVertices();
+    if ((int)scratch.residualDistance.size() != numVertices) {
+        scratch.residualDistance.assign(numVertices, LEO_UNREACHABLE);
+        scratch.residualParent.assign(numVertices, -1);
+        scratch.residualOnPath.assign(numVertices, 0);
+    }
+    const LeoVertexPosition& goal = positions[target];
+    auto heuristic = [&](int vertex) {
+        const LeoVertexPosition& position = positions[vertex];
+        const double dx = position.x - goal.x, dy = position.y - goal.y, dz = position.z - goal.z;
+        return std::sqrt(dx * dx + dy * dy + dz * dz) * costPerMetre;
+    };
+
+    // The heap is keyed by distance + heuristic; residualOnPath marks closed vertices
+    std::vector<double>& distance = scratch.residualDistance;
+    std::vector<int>& parent = scratch.residualParent;
+    std::vector<char>& closed = scratch.residualOnPath;
+    scratch.heap.clear();
+    scratch.residualTouched.clear();
+    distance[source] = 0;
+    scratch.residualTouched.push_back(source);
+    pushHeap(scratch, heuristic(source), source);
+    while (!scratch.heap.empty()) {
+        const int vertex = popHeap(scratch).second;
+        if (closed[vertex])
+            continue;
+        closed[vertex] = 1;
+        if (vertex == target)
+            break;
+        for (const LeoRoutingGraph::Arc *arc = graph.arcsBegin(vertex); arc != graph.arcsEnd(vertex); ++arc) {
+            const int neighbour = arc->target;
+            const double candidate = distance[vertex] + arc->weight;
+            if (!closed[neighbour] && candidate < distance[neighbour]) {
+                if (distance[neighbour] == LEO_UNREACHABLE)
+                    scratch.residualTouched.push_back(neighbour);
+                distance[neighbour] = candidate;
+                parent[neighbour] = vertex;
+                pushHeap(scratch, candidate + heuristic(neighbour), neighbour);
+            }
+        }
+    }
+
+    const double cost = distance[target];
+    path.clear();
+    if (cost < LEO_UNREACHABLE) {
+        for (int vertex = target; vertex != -1; vertex = parent[vertex])
+            path.push_back(vertex);
+        std::reverse(path.begin(), path.end());
+    }
+    for (int vertex : scratch.residualTouched) {
+        distance[vertex] = LEO_UNREACHABLE;
+        parent[vertex] = -1;
+        closed[vertex] = 0;
+    }
+    return cost;
+}
+
+} // namespace inet
@@ -0,0 +1,169 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef NETWORKLAYER_CONFIGURATOR_IPV4_LEOROUTINGGRAPH_H_
+#define NETWORKLAYER_CONFIGURATOR_IPV4_LEOROUTINGGRAPH_H_
+
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace inet {
+
+//-----------------------------------------------------
+// Class: LeoRoutingGraph
+//
+// Undirected, weighted snapshot of the constellation topology for one routing
+// interval, stored as a compressed adjacency list. Vertices are node graph ids
+// (satellites first, then ground stations) and weights are propagation delays
+// in milliseconds. The class only depends on the standard library so the
+// route computation can run on worker threads and outside of a simulation.
+//-----------------------------------------------------
+class LeoRoutingGraph
+{
+  public:
+    struct Arc {
+        int target;
+        double weight;
+    };
+
+    // Builds the graph from an edge list: edge i connects edgeEndpoints[2*i]
+    // and edgeEndpoints[2*i+1] with weight edgeWeights[i].
+    void build(int numVertices, const std::vector<int>& edgeEndpoints, const std::vector<double>& edgeWeights);
+
+    int getNumVertices() const { return numVertices; }
+    int getNumEdges() const { return numEdges; }
+
+    const Arc *arcsBegin(int vertex) const { return arcs.data() + arcOffsets[vertex]; }
+    const Arc *arcsEnd(int vertex) const { return arcs.data() + arcOffsets[vertex + 1]; }
+    int getDegree(int vertex) const { return arcOffsets[vertex + 1] - arcOffsets[vertex]; }
+
+    // Returns the weight of the edge between the two vertices, or infinity if they are not adjacent.
+    double getEdgeWeight(int from, int to) const;
+
+  protected:
+    int numVertices = 0;
+    int numEdges = 0;
+    std::vector<int> arcOffsets;
+    std::vector<Arc> arcs;
+};
+
+// Shortest path tree rooted at one vertex. Distances of unreachable vertices
+// are infinite and their parent is -1. order lists the reachable vertices so
+// that every parent comes before its children.
+struct LeoShortestPathTree
+{
+    std::vector<double> distance;
+    std::vector<int> parent;
+    std::vector<int> order;
+
+    bool isValid() const { return !order.empty(); }
+};
+
+// Per-thread working memory of the shortest path routines. The heap holds
+// (distance, vertex) entries and stale entries are skipped when popped; the
+// other buffers are sized to the graph on first use and then reused.
+struct LeoDijkstraScratch
+{
+    std::vector<std::pair<double, int>> heap;
+    std::vector<char> marks;
+    std::vector<int> detached;
+    std::vector<int> childOffsets;
+    std::vector<int> children;
+    std::vector<double> residualDistance;
+    std::vector<int> residualParent;
+    std::vector<int> residualTouched;
+    std::vector<char> residualOnPath;
+};
+
+// Cartesian position of a vertex in meters, used as the A* heuristic
+struct LeoVertexPosition
+{
+    double x, y, z;
+};
+
+constexpr double LEO_UNREACHABLE = std::numeric_limits<double>::infinity();
+
+// Computes the shortest path tree from root with Dijkstra's algorithm.
+void computeShortestPathTree(const LeoRoutingGraph& graph, int root, LeoShortestPathTree& tree, LeoDijkstraScratch& scratch);
+
+// Weight of one edge in two versions of a graph with the same vertex set. An
+// edge that does not exist in a version has an infinite weight there.
+struct LeoEdgeChange
+{
+    int from;
+    int to;
+    double oldWeight;
+    double newWeight;
+};
+
+// Lists the edges whose weight differs between the two graphs, once per vertex pair.
+void diffRoutingGraphs(const LeoRoutingGraph& previous, const LeoRoutingGraph& current, std::vector<LeoEdgeChange>& changes);
+
+// Work done by one tree repair: vertices whose arcs were scanned and the arcs scanned
+struct LeoTreeRepairCount
+{
+    long scannedVertices = 0;
+    long scannedArcs = 0;
+};
+
+// Repairs a tree that was computed on the previous version of the graph, given
+// the edges that changed since (Ramalingam-Reps). Only the subtrees below tree
+// edges that became longer or disappeared are detached and re-seeded from their
+// neighbours, and only the endpoints of edges that became shorter or appeared are
+// relaxed; the heap then visits just the vertices whose distance changes. An
+// invalid tree is computed from scratch.
+LeoTreeRepairCount repairShortestPathTree(const LeoRoutingGraph& graph, int root, const std::vector<LeoEdgeChange>& changes,
+                                          LeoShortestPathTree& tree, LeoDijkstraScratch& scratch);
+
+// Fills firstHop[v] with the neighbour of root on the tree path towards v, or
+// -1 for the root itself and for unreachable vertices.
+void computeFirstHops(const LeoShortestPathTree& tree, int root, std::vector<int>& firstHop);
+
+// Ranks the next hops of every vertex towards the root of a shortest path tree.
+// Rank 1 is the tree parent; the following ranks are the other neighbours n
+// closer to the root than the vertex itself, ordered by w(v,n) + dist(n). Since
+// every hop strictly decreases the distance, any mix of ranks along a path is
+// loop free. nextHops[v*k + r] holds rank r+1 of vertex v, or -1.
+void computeRankedNextHops(const LeoRoutingGraph& graph, const LeoShortestPathTree& tree, int root, int k, std::vector<int>& nextHops);
+
+// Returns the next hop of vertex towards root on the second path of the
+// minimum cost edge-disjoint pair between them (Suurballe), or -1 if there is
+// no such pair. The first path always leaves vertex through its tree parent.
+// The tree of root is shared by all vertices; each call runs one Dijkstra on
+// the residual graph that stops as soon as vertex is reached. Assumes at most
+// one link between two vertices.
+int computeDisjointNextHop(const LeoRoutingGraph& graph, const LeoShortestPathTree& tree, int root, int vertex, LeoDijkstraScratch& scratch);
+
+// Next hops of every vertex towards root as the configurator installs them: the
+// ranked next hops above, or with edgeDisjoint (k = 2) the tree parent followed
+// by the disjoint next hop. equalCost[v*k + r] is set for ranked alternatives
+// whose path cost is at most (1 + costSlack) times that of the shortest path.
+void computeDestinationNextHops(const LeoRoutingGraph& graph, const LeoShortestPathTree& tree, int root, int k, bool edgeDisjoint,
+                                double costSlack, LeoDijkstraScratch& scratch, std::vector<int>& nextHops, std::vector<char>& equalCost);
+
+// Shortest path from source to target with A*. The heuristic of a vertex is its
+// straight line distance to the target times costPerMetre, which never
+// overestimates as long as no edge is cheaper than the same distance in a
+// straight line. Fills path with the vertices from source to target and
+// returns the path cost, or infinity (and an empty path) if target is not
+// reachable. Uses the residual buffers of scratch.
+double computeAStarPath(const LeoRoutingGraph& graph, int source, int target, const std::vector<LeoVertexPosition>& positions,
+                        double costPerMetre, LeoDijkstraScratch& scratch, std::vector<int>& path);
+
+} // namespace inet
+
+#endif /* NETWORKLAYER_CONFIGURATOR_IPV4_LEOROUTINGGRAPH_H_ */
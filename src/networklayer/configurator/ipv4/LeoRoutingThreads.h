@@ -0,0 +1,94 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef NETWORKLAYER_CONFIGURATOR_IPV4_LEOROUTINGTHREADS_H_
+#define NETWORKLAYER_CONFIGURATOR_IPV4_LEOROUTINGTHREADS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small threading helpers shared by the route computation code. They only
+// depend on the standard library so the routing code can also be reused
+// outside of a simulation.
+namespace inet {
+
+// Returns the number of worker threads to use for workItems independent
+// tasks. A requested count of 0 (or less) means one thread per hardware core.
+inline int resolveRoutingThreadCount(int requestedThreads, int workItems)
+{
+    int numThreads = requestedThreads > 0 ? requestedThreads : static_cast<int>(std::thread::hardware_concurrency());
+    if (numThreads <= 0)
+        numThreads = 1;
+    return std::max(1, std::min(numThreads, workItems));
+}
+
+// Calls fn(item, workerIndex) for every item in [begin, end) using up to
+// numThreads threads. Items are handed out one at a time so that sources with
+// very different costs still balance out. workerIndex is in [0, numThreads)
+// and can be used to index per-thread scratch state. The first exception
+// thrown by fn is rethrown in the calling thread once all workers stopped.
+template <typename Fn>
+void parallelForEach(int begin, int end, int numThreads, Fn&& fn)
+{
+    if (end <= begin)
+        return;
+    numThreads = std::max(1, std::min(numThreads, end - begin));
+    if (numThreads == 1) {
+        for (int item = begin; item < end; item++)
+            fn(item, 0);
+        return;
+    }
+
+    std::atomic<int> nextItem(begin);
+    std::atomic<bool> failed(false);
+    std::exception_ptr firstError;
+    std::mutex errorMutex;
+
+    auto worker = [&](int workerIndex) {
+        while (!failed.load(std::memory_order_relaxed)) {
+            const int item = nextItem.fetch_add(1, std::memory_order_relaxed);
+            if (item >= end)
+                break;
+            try {
+                fn(item, workerIndex);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!firstError)
+                    firstError = std::current_exception();
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads - 1);
+    for (int workerIndex = 1; workerIndex < numThreads; workerIndex++)
+        threads.emplace_back(worker, workerIndex);
+    worker(0);
+    for (auto& thread : threads)
+        thread.join();
+
+    if (firstError)
+        std::rethrow_exception(firstError);
+}
+
+} // namespace inet
+
+#endif /* NETWORKLAYER_CONFIGURATOR_IPV4_LEOROUTINGTHREADS_H_ */
@@ -0,0 +1,164 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#include "LeoForwardingTable.h"
+
+#include <algorithm>
+#include <omnetpp.h>
+
+using namespace omnetpp;
+
+namespace inet {
+
+void LeoForwardingArena::allocate(int numTables, int numDestinations, int numRanks)
+{
+    this->numDestinations = numDestinations;
+    this->numRanks = numRanks;
+    entries.assign((size_t)numTables * numDestinations * numRanks, 0);
+}
+
+void LeoForwardingTable::attach(uint16_t *entries, int numDestinations, int numRanks)
+{
+    this->entries = entries;
+    this->numDestinations = numDestinations;
+    this->numRanks = numRanks;
+    ranges.clear();
+    clear();
+}
+
+void LeoForwardingTable::attachRanges(int numDestinations, int numRanks)
+{
+    entries = nullptr;
+    this->numDestinations = numDestinations;
+    this->numRanks = numRanks;
+    ranges.assign(numRanks, RangeList());
+}
+
+void LeoForwardingTable::clear()
+{
+    if (entries != nullptr)
+        std::fill(entries, entries + (size_t)numDestinations * numRanks, 0);
+    for (RangeList& list : ranges) {
+        list.starts.clear();
+        list.ordinals.clear();
+        list.end = 0;
+    }
+}
+
+void LeoForwardingTable::setNextHop(int rank, int destination, int interfaceId, bool equalCost)
+{
+    if (destination < 0 || destination >= numDestinations || rank < 1 || rank > numRanks)
+        throw cRuntimeError("Forwarding entry (rank %d, destination %d) is outside of the table (%d ranks, %d destinations)",
+                            rank, destination, numRanks, numDestinations);
+    const uint16_t ordinal = interfaceId > 0 ? getOrdinal(interfaceId) | (equalCost ? EQUAL_COST_FLAG : 0) : 0;
+    if (entries != nullptr)
+        entries[(size_t)(rank - 1) * numDestinations + destination] = ordinal;
+    else
+        setRangeOrdinal(ranges[rank - 1], destination, ordinal);
+}
+
+uint16_t LeoForwardingTable::findRangeOrdinal(const RangeList& list, int destination)
+{
+    if (destination >= list.end || list.starts.empty() || destination < list.starts.front())
+        return 0;
+    auto it = std::upper_bound(list.starts.begin(), list.starts.end(), destination);
+    return list.ordinals[it - list.starts.begin() - 1];
+}
+
+void LeoForwardingTable::setRangeOrdinal(RangeList& list, int destination, uint16_t ordinal)
+{
+    std::vector<int>& starts = list.starts;
+    std::vector<uint16_t>& ordinals = list.ordinals;
+
+    // Routes are installed in increasing destination order, which only appends
+    if (destination >= list.end) {
+        auto append = [&](int start, uint16_t rangeOrdinal) {
+            if (ordinals.empty() ? rangeOrdinal != 0 : ordinals.back() != rangeOrdinal) {
+                starts.push_back(start);
+                ordinals.push_back(rangeOrdinal);
+            }
+        };
+        if (destination > list.end)
+            append(list.end, 0);
+        append(destination, ordinal);
+        list.end = destination + 1;
+        return;
+    }
+
+    // Otherwise split the range holding the destination and merge equal neighbours
+    if (findRangeOrdinal(list, destination) == ordinal)
+        return;
+    if (starts.empty() || destination < starts.front()) {
+        starts.insert(starts.begin(), 0);
+        ordinals.insert(ordinals.begin(), 0);
+    }
+    size_t i = std::upper_bound(starts.begin(), starts.end(), destination) - starts.begin() - 1;
+    const int rangeEnd = i + 1 < starts.size() ? starts[i + 1] : list.end;
+    const uint16_t previousOrdinal = ordinals[i];
+    if (destination + 1 < rangeEnd) {
+        starts.insert(starts.begin() + i + 1, destination + 1);
+        ordinals.insert(ordinals.begin() + i + 1, previousOrdinal);
+    }
+    if (destination > starts[i]) {
+        i++;
+        starts.insert(starts.begin() + i, destination);
+        ordinals.insert(ordinals.begin() + i, ordinal);
+    }
+    else
+        ordinals[i] = ordinal;
+
+    if (i + 1 < starts.size() && ordinals[i + 1] == ordinal) {
+        starts.erase(starts.begin() + i + 1);
+        ordinals.erase(ordinals.begin() + i + 1);
+    }
+    if (i > 0 && ordinals[i - 1] == ordinal) {
+        starts.erase(starts.begin() + i);
+        ordinals.erase(ordinals.begin() + i);
+    }
+    // destinations before the first range have no route anyway
+    if (ordinals.front() == 0) {
+        starts.erase(starts.begin());
+        ordinals.erase(ordinals.begin());
+    }
+}
+
+uint16_t LeoForwardingTable::getOrdinal(int interfaceId)
+{
+    // A node only has a handful of interfaces, so a linear search is the fastest lookup
+    auto it = std::find(interfaceIds.begin(), interfaceIds.end(), interfaceId);
+    if (it != interfaceIds.end())
+        return it - interfaceIds.begin() + 1;
+    if (interfaceIds.size() >= EQUAL_COST_FLAG - 1)
+        throw cRuntimeError("Too many interfaces in forwarding table");
+    interfaceIds.push_back(interfaceId);
+    return interfaceIds.size();
+}
+
+size_t LeoForwardingTable::getMemoryUsage() const
+{
+    if (entries != nullptr)
+        return getDenseMemoryUsage();
+    size_t bytes = interfaceIds.capacity() * sizeof(int) + ranges.capacity() * sizeof(RangeList);
+    for (const RangeList& list : ranges)
+        bytes += list.starts.capacity() * sizeof(int) + list.ordinals.capacity() * sizeof(uint16_t);
+    return bytes;
+}
+
+size_t LeoForwardingTable::getDenseMemoryUsage() const
+{
+    return (size_t)numDestinations * numRanks * sizeof(uint16_t) + interfaceIds.capacity() * sizeof(int);
+}
+
+} // namespace inet
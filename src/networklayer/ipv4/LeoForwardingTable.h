@@ -0,0 +1,136 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef NETWORKLAYER_IPV4_LEOFORWARDINGTABLE_H_
+#define NETWORKLAYER_IPV4_LEOFORWARDINGTABLE_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace inet {
+
+//-----------------------------------------------------
+// Class: LeoForwardingArena
+//
+// One block of memory holding the forwarding entries of every routable node in
+// the constellation. Each node owns numRanks * numDestinations interface
+// ordinals laid out as [rank][destination], so the memory footprint is known
+// as soon as the constellation size is.
+//-----------------------------------------------------
+class LeoForwardingArena
+{
+  public:
+    void allocate(int numTables, int numDestinations, int numRanks);
+    void clear() { std::fill(entries.begin(), entries.end(), 0); }
+    uint16_t *getTableEntries(int tableIndex) { return entries.data() + (size_t)tableIndex * numDestinations * numRanks; }
+    int getNumDestinations() const { return numDestinations; }
+    int getNumRanks() const { return numRanks; }
+    size_t getMemoryUsage() const { return entries.size() * sizeof(uint16_t); }
+
+  protected:
+    std::vector<uint16_t> entries;
+    int numDestinations = 0;
+    int numRanks = 0;
+};
+
+//-----------------------------------------------------
+// Class: LeoForwardingTable
+//
+// Forwarding state of one node. Entries are small interface ordinals into a
+// per-node dictionary of interface IDs, with 0 meaning no route. The entries
+// either live in the LeoForwardingArena of the configurator (dense) or are
+// kept as sorted destination ranges per rank (ranges). In a +Grid
+// constellation long runs of consecutive destination IDs leave through the
+// same interface, so the ranges take a fraction of the dense memory.
+//
+// The top bit of an ordinal marks next hops whose path cost is close enough to
+// the shortest path to share its flows (equal cost multipath).
+//-----------------------------------------------------
+class LeoForwardingTable
+{
+  public:
+    static constexpr uint16_t EQUAL_COST_FLAG = 0x8000;
+
+    void attach(uint16_t *entries, int numDestinations, int numRanks);
+    void attachRanges(int numDestinations, int numRanks);
+    void clear();
+    void setNextHop(int rank, int destination, int interfaceId, bool equalCost = false);
+
+    // Returns the interface ID of the rank-th next hop towards destination, or 0 if there is none
+    int getNextHop(int rank, int destination) const
+    {
+        if (destination < 0 || destination >= numDestinations || rank < 1 || rank > numRanks)
+            return 0;
+        const uint16_t ordinal = getEntry(rank, destination) & ~EQUAL_COST_FLAG;
+        return ordinal != 0 ? interfaceIds[ordinal - 1] : 0;
+    }
+
+    // Returns one of the equal cost next hops towards destination, the shortest
+    // path included, picked by flowHash; 0 if there is no route
+    int getEqualCostNextHop(int destination, uint32_t flowHash) const
+    {
+        if (destination < 0 || destination >= numDestinations || numRanks == 0 || getEntry(1, destination) == 0)
+            return 0;
+        int numEqualCost = 1;
+        for (int rank = 2; rank <= numRanks; rank++) {
+            const uint16_t ordinal = getEntry(rank, destination);
+            if (ordinal == 0)
+                break;
+            if (ordinal & EQUAL_COST_FLAG)
+                numEqualCost++;
+        }
+        int choice = flowHash % numEqualCost;
+        for (int rank = 1; rank <= numRanks; rank++) {
+            const uint16_t ordinal = getEntry(rank, destination);
+            if ((rank == 1 || (ordinal & EQUAL_COST_FLAG)) && choice-- == 0)
+                return interfaceIds[(ordinal & ~EQUAL_COST_FLAG) - 1];
+        }
+        return 0;
+    }
+
+    int getNumDestinations() const { return numDestinations; }
+    int getNumRanks() const { return numRanks; }
+    size_t getMemoryUsage() const;
+    size_t getDenseMemoryUsage() const;
+
+  protected:
+    // Destinations [starts[i], starts[i+1]) use ordinals[i]; the last range ends
+    // at end. Adjacent ranges never share an ordinal.
+    struct RangeList {
+        std::vector<int> starts;
+        std::vector<uint16_t> ordinals;
+        int end = 0;
+    };
+
+    uint16_t getEntry(int rank, int destination) const
+    {
+        return entries != nullptr ? entries[(size_t)(rank - 1) * numDestinations + destination] : findRangeOrdinal(ranges[rank - 1], destination);
+    }
+    uint16_t getOrdinal(int interfaceId);
+    static uint16_t findRangeOrdinal(const RangeList& list, int destination);
+    static void setRangeOrdinal(RangeList& list, int destination, uint16_t ordinal);
+
+    uint16_t *entries = nullptr;
+    std::vector<RangeList> ranges;
+    int numDestinations = 0;
+    int numRanks = 0;
+    std::vector<int> interfaceIds; // ordinal - 1 -> interface ID
+};
+
+} // namespace inet
+
+#endif /* NETWORKLAYER_IPV4_LEOFORWARDINGTABLE_H_ */
@@ -14,15 +14,37 @@
 // 
 #include "LeoIpv4.h"
 
-#include <algorithm>
-
 #include <inet/common/ModuleAccess.h>
+#include <inet/transportlayer/tcp_common/TcpHeader.h>
+#include <inet/transportlayer/udp/UdpHeader_m.h>
 #include "../configurator/ipv4/LeoIpv4NetworkConfigurator.h"
 
 namespace inet {
 
 Define_Module(LeoIpv4);
 
+// Experimental option number (RFC 4727) with the copied flag set, so fragments keep it
+static const int IPOPTION_ROUTING_EPOCH = 0x9e;
+// Same number in class 2, holds the hop count followed by 16-bit node IDs
+static const int IPOPTION_SOURCE_ROUTE = 0xde;
+static const B IPV4_MAX_OPTIONS_LENGTH = B(40);
+
+static int getSourceRouteHop(const Ipv4OptionUnknown *option, int index)
+{
+    return option->getBytes(1 + 2 * index) << 8 | option->getBytes(2 + 2 * index);
+}
+
+// 64-bit finalizer of MurmurHash3
+static uint32_t mixFlowKey(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
 LeoIpv4::LeoIpv4()
 {
 }
@@ -36,35 +58,103 @@ LeoIpv4::~LeoIpv4()
 void LeoIpv4::initialize(int stage)
 {
     Ipv4::initialize(stage);
-    if (stage == INITSTAGE_LOCAL)
+    if (stage == INITSTAGE_LOCAL) {
         configurator = dynamic_cast<LeoIpv4NetworkConfigurator *>(getParentModule()->getParentModule()->getParentModule()->getSubmodule("configurator"));
+        int flowCacheSize = par("flowCacheSize");
+        if (flowCacheSize < 0 || (flowCacheSize & (flowCacheSize - 1)) != 0)
+            throw cRuntimeError("flowCacheSize must be 0 or a power of two, got %d", flowCacheSize);
+        flowCache.assign(flowCacheSize, FlowCacheEntry());
+
+        std::string mode = par("forwardingMode").stdstringValue();
+        if (mode == "primary")
+            forwardingMode = PRIMARY;
+        else if (mode == "ecmp")
+            forwardingMode = ECMP;
+        else if (mode == "flowlet")
+            forwardingMode = FLOWLET;
+        else
+            throw cRuntimeError("Unknown forwardingMode '%s'", mode.c_str());
+        fastReroute = par("fastReroute");
+        flowletTimeout = par("flowletTimeout");
+        int flowletTableSize = par("flowletTableSize");
+        if (flowletTableSize <= 0 || (flowletTableSize & (flowletTableSize - 1)) != 0)
+            throw cRuntimeError("flowletTableSize must be a power of two, got %d", flowletTableSize);
+        if (forwardingMode == FLOWLET)
+            flowlets.assign(flowletTableSize, FlowletEntry());
+    }
+}
+
+void LeoIpv4::finish()
+{
+    Ipv4::finish();
+    if (flowCacheHits + flowCacheMisses > 0) {
+        recordScalar("flowCacheHits", flowCacheHits);
+        recordScalar("flowCacheMisses", flowCacheMisses);
+        recordScalar("flowCacheHitRate", (double)flowCacheHits / (flowCacheHits + flowCacheMisses));
+    }
+    if (numFlowlets > 0)
+        recordScalar("flowlets", numFlowlets);
+    if (numFastReroutes > 0)
+        recordScalar("fastReroutes", numFastReroutes);
+    if (numPreviousEpochPackets > 0)
+        recordScalar("previousEpochPackets", numPreviousEpochPackets);
+    if (numMovedPreviousEpochHops > 0)
+        recordScalar("movedPreviousEpochHops", numMovedPreviousEpochHops);
+    if (numSourceRoutes > 0)
+        recordScalar("sourceRoutes", numSourceRoutes);
 }
 
 void LeoIpv4::setNodeId(int id)
 {
     nodeId = id;
 }
-void LeoIpv4::addKNextHop(int k, int destNode, int nextInterfaceID)
+void LeoIpv4::addKNextHop(int k, int destNode, int nextInterfaceID, bool equalCost)
 {
-    if (k == 1) {
-        if (destNode >= static_cast<int>(primaryNextHopInterfaces.size()))
-            primaryNextHopInterfaces.resize(destNode + 1, 0);
-        primaryNextHopInterfaces[destNode] = nextInterfaceID;
-    }
-    else {
-        kNextHops[k][destNode] = nextInterfaceID;
-    }
+    forwardingTable.setNextHop(k, destNode, nextInterfaceID, equalCost);
 }
 
-void LeoIpv4::addNextHop(uint32_t destinationAddr, uint32_t nextInterfaceID)
+void LeoIpv4::clearNextHops(){
+    forwardingTable.clear();
+}
+
+void LeoIpv4::rotateForwardingTables(uint16_t *entries)
 {
-    nextHops[destinationAddr] = nextInterfaceID;
+    // The current tables become the previous ones and the new current tables
+    // reuse the memory of the epoch before
+    std::swap(forwardingTable, previousForwardingTable);
+    if (entries != nullptr)
+        forwardingTable.attach(entries, previousForwardingTable.getNumDestinations(), previousForwardingTable.getNumRanks());
+    else
+        forwardingTable.attachRanges(previousForwardingTable.getNumDestinations(), previousForwardingTable.getNumRanks());
 }
 
-void LeoIpv4::clearNextHops(){
-    nextHops.clear();
-    kNextHops.clear();
-    std::fill(primaryNextHopInterfaces.begin(), primaryNextHopInterfaces.end(), 0);
+bool LeoIpv4::admitRoutingEpoch(Packet *packet)
+{
+    // Returns true if the packet was admitted under the previous routing epoch and
+    // that epoch is still within its in-flight window; packets without an epoch
+    // are stamped with the current one
+    const unsigned int currentEpoch = configurator->getRoutingEpoch() & 0xffff;
+    const auto& ipv4Header = packet->peekAtFront<Ipv4Header>();
+    if (auto option = dynamic_cast<const Ipv4OptionUnknown *>(ipv4Header->findOptionByType(IPOPTION_ROUTING_EPOCH))) {
+        if (option->getBytesArraySize() != 2)
+            return false;
+        const unsigned int packetEpoch = option->getBytes(0) << 8 | option->getBytes(1);
+        return packetEpoch == ((currentEpoch - 1) & 0xffff) && simTime() < configurator->getRoutingEpochStart() + configurator->getInFlightWindow();
+    }
+
+    auto header = packet->removeAtFront<Ipv4Header>();
+    auto option = new Ipv4OptionUnknown();
+    option->setType(IPOPTION_ROUTING_EPOCH);
+    option->setLength(4);
+    option->setBytesArraySize(2);
+    option->setBytes(0, currentEpoch >> 8);
+    option->setBytes(1, currentEpoch & 0xff);
+    header->addOption(option);
+    header->setHeaderLength(header->getHeaderLength() + B(4));
+    header->setChunkLength(header->getHeaderLength());
+    header->setTotalLengthField(header->getTotalLengthField() + B(4));
+    packet->insertAtFront(header);
+    return false;
 }
 
 void LeoIpv4::routeUnicastPacket(Packet *packet)
@@ -76,6 +166,7 @@ void LeoIpv4::routeUnicastPacket(Packet *packet)
     // Initial Syn packet does not have either source or dest interface set
     Ipv4Address nextHopAddress = getNextHop(packet);
 
+    const bool previousEpoch = configurator->getInFlightWindow() > 0 && admitRoutingEpoch(packet);
     const auto& ipv4Header = packet->peekAtFront<Ipv4Header>();
     Ipv4Address destAddr = ipv4Header->getDestAddress();
     EV_INFO << "Routing " << packet << " with destination = " << destAddr << ", ";
@@ -100,35 +191,60 @@ void LeoIpv4::routeUnicastPacket(Packet *packet)
     //}
     //else {
         // use Ipv4 routing (lookup in routing table)
-    int modId = configurator->getModuleIdFromIpAddress(destAddr.getInt()); //TODO check if IP address is end point, if is, get ground station IP
-
-    const int currentNodeType = configurator->getNodeTypeCode(nodeId);
-    const int destinationNodeType = configurator->getNodeTypeCode(modId);
-    int interfaceID = (modId >= 0 && modId < static_cast<int>(primaryNextHopInterfaces.size())) ? primaryNextHopInterfaces[modId] : 0;
-    const int baseInterfaceId = interfaceID;
-    int attachedNodeId = -1;
-    int routeToAttachedNodeInterfaceId = -1;
-    int endpointAttachmentInterfaceId = -1;
-    int currentEndpointUplinkInterfaceId = currentNodeType == 2 ? configurator->getEndpointUplinkInterfaceId(nodeId) : -1;
-    int destinationEndpointUplinkInterfaceId = destinationNodeType == 2 ? configurator->getEndpointUplinkInterfaceId(modId) : -1;
-
-    if (destinationNodeType == 2 && modId >= 0) {
-        attachedNodeId = configurator->getGroundStationFromEndPoint(modId);
-        endpointAttachmentInterfaceId = configurator->getEndpointAttachmentInterfaceId(modId);
-        routeToAttachedNodeInterfaceId = (attachedNodeId >= 0 && attachedNodeId < static_cast<int>(primaryNextHopInterfaces.size())) ? primaryNextHopInterfaces[attachedNodeId] : 0;
-        if (nodeId == attachedNodeId) {
-            interfaceID = endpointAttachmentInterfaceId;
+    const uint32_t destination = destAddr.getInt();
+    const uint64_t epoch = configurator->getForwardingEpoch();
+    const uint32_t flowHash = forwardingMode != PRIMARY && !configurator->isSourceRouting() ? computeFlowHash(packet, ipv4Header.get()) : 0;
+    int interfaceID;
+    if (configurator->isSourceRouting())
+        interfaceID = routeBySourceRoute(packet, destination);
+    else if (previousEpoch) {
+        // in flight since before the last route change, keep following the old routes
+        interfaceID = resolveOutputInterface(destination, flowHash, previousForwardingTable);
+        if (interfaceID > 0) {
+            // towards the neighbour the old routes chose, through whichever interface reaches it now
+            const int resolvedInterfaceID = configurator->resolvePreviousEpochInterface(nodeId, interfaceID);
+            if (resolvedInterfaceID != interfaceID)
+                numMovedPreviousEpochHops++;
+            interfaceID = resolvedInterfaceID > 0 ? resolvedInterfaceID : resolveOutputInterface(destination, flowHash, forwardingTable);
         }
-        else if (currentNodeType == 2) {
-            interfaceID = currentEndpointUplinkInterfaceId;
+        numPreviousEpochPackets++;
+    }
+    else if (forwardingMode == FLOWLET) {
+        // A flow keeps its next hop while its packets are closer than flowletTimeout;
+        // after an idle gap it can move without reordering
+        FlowletEntry& flowlet = flowlets[flowHash & (flowlets.size() - 1)];
+        if (flowlet.flowHash != flowHash || flowlet.epoch != epoch || flowlet.interfaceId <= 0 || simTime() - flowlet.lastSeen > flowletTimeout) {
+            flowlet.flowHash = flowHash;
+            flowlet.epoch = epoch;
+            flowlet.interfaceId = resolveOutputInterface(destination, mixFlowKey(((uint64_t)flowHash << 32) | (uint32_t)numFlowlets), forwardingTable);
+            numFlowlets++;
+        }
+        flowlet.lastSeen = simTime();
+        interfaceID = flowlet.interfaceId;
+    }
+    else {
+        FlowCacheEntry *cacheEntry = nullptr;
+        if (!flowCache.empty()) {
+            // Fibonacci hashing spreads the node bits of the address over the cache
+            cacheEntry = &flowCache[(((destination ^ flowHash) * 0x9E3779B97F4A7C15ull) >> 32) & (flowCache.size() - 1)];
+        }
+        if (cacheEntry != nullptr && cacheEntry->epoch == epoch && cacheEntry->destination == destination && cacheEntry->flowHash == flowHash) {
+            interfaceID = cacheEntry->interfaceId;
+            flowCacheHits++;
         }
         else {
-            interfaceID = routeToAttachedNodeInterfaceId;
+            interfaceID = resolveOutputInterface(destination, flowHash, forwardingTable);
+            if (cacheEntry != nullptr) {
+                flowCacheMisses++;
+                if (interfaceID > 0) {
+                    cacheEntry->destination = destination;
+                    cacheEntry->flowHash = flowHash;
+                    cacheEntry->interfaceId = interfaceID;
+                    cacheEntry->epoch = epoch;
+                }
+            }
         }
     }
-    else if (interfaceID <= 0 && currentNodeType == 2) {
-        interfaceID = currentEndpointUplinkInterfaceId;
-    }
 
     if (interfaceID > 0) {
         packet->addTagIfAbsent<InterfaceReq>()->setInterfaceId(interfaceID);
@@ -136,7 +252,7 @@ void LeoIpv4::routeUnicastPacket(Packet *packet)
     }
     else{
         EV_WARN << "\nInterface ID not found!: ID " << interfaceID << " at time: " << simTime() << endl;
-        std::cout << "\nInterface ID not found!: Dest Addr " << destAddr.getInt() << " Mod ID " << modId << " ID " << interfaceID << " at time: " << simTime() << endl;
+        std::cout << "\nInterface ID not found!: Dest Addr " << destAddr.getInt() << " Mod ID " << configurator->getNodeIdFromAddress(destination) << " ID " << interfaceID << " at time: " << simTime() << endl;
     }
     //}
 
@@ -160,10 +276,169 @@ void LeoIpv4::routeUnicastPacket(Packet *packet)
     }
 }
 
+int LeoIpv4::resolveOutputInterface(uint32_t destination, uint32_t flowHash, const LeoForwardingTable& table)
+{
+    // The destination node and the endpoint attachments are plain array reads
+    int modId = configurator->getNodeIdFromAddress(destination);
+    const int currentNodeType = configurator->getNodeType(nodeId);
+
+    if (currentNodeType == 2) {
+        // endpoints send everything over their uplink
+        return configurator->getUplinkInterface(nodeId);
+    }
+    if (configurator->getNodeType(modId) == 2) {
+        const int attachedNodeId = configurator->getAttachedNode(modId);
+        if (nodeId == attachedNodeId)
+            return configurator->getAttachmentInterface(modId);
+        modId = attachedNodeId;
+    }
+    // In lazy routing mode the first miss towards a destination routes it for the whole interval
+    const bool mayRouteOnDemand = &table == &forwardingTable;
+    // and with lazy route loading the first lookup of the node loads its table
+    if (mayRouteOnDemand)
+        configurator->ensureNodeRoutes(nodeId);
+    int interfaceId;
+    do {
+        if (forwardingMode == PRIMARY)
+            interfaceId = table.getNextHop(1, modId);
+        else {
+            // salt the hash per node, otherwise every hop would make the same choice
+            interfaceId = table.getEqualCostNextHop(modId, mixFlowKey(((uint64_t)nodeId << 32) | flowHash));
+        }
+    } while (interfaceId <= 0 && mayRouteOnDemand && configurator->routeOnDemand(modId));
+    if (fastReroute && interfaceId > 0 && !isInterfaceUp(interfaceId))
+        interfaceId = findLoopFreeAlternate(table, modId);
+    return interfaceId;
+}
+
+int LeoIpv4::findLoopFreeAlternate(const LeoForwardingTable& table, int destinationNode)
+{
+    // Ranked next hops are closer to the destination than this node (the LFA
+    // downstream condition), so the first one that is still up can be used until
+    // the routes are recomputed. The second hop of an edge-disjoint pair may lead
+    // away from the destination and loop back over the failed link, so it is not
+    // an alternate.
+    const int numRanks = std::min(table.getNumRanks(), configurator->getNumLoopFreeRanks());
+    for (int rank = 1; rank <= numRanks; rank++) {
+        const int interfaceId = table.getNextHop(rank, destinationNode);
+        if (interfaceId <= 0)
+            break;
+        if (isInterfaceUp(interfaceId)) {
+            numFastReroutes++;
+            return interfaceId;
+        }
+    }
+    return 0;
+}
+
+int LeoIpv4::routeBySourceRoute(Packet *packet, uint32_t destination)
+{
+    if (configurator->getNodeType(nodeId) == 2)
+        return configurator->getUplinkInterface(nodeId);
+    int egressNode = configurator->getNodeIdFromAddress(destination);
+    if (configurator->getNodeType(egressNode) == 2) {
+        const int attachedNodeId = configurator->getAttachedNode(egressNode);
+        if (nodeId == attachedNodeId)
+            return configurator->getAttachmentInterface(egressNode);
+        egressNode = attachedNodeId;
+    }
+    if (egressNode < 0 || egressNode == nodeId)
+        return 0;
+
+    // Transit nodes find themselves in the hop list and forward to the following hop
+    const auto& ipv4Header = packet->peekAtFront<Ipv4Header>();
+    if (auto option = dynamic_cast<const Ipv4OptionUnknown *>(ipv4Header->findOptionByType(IPOPTION_SOURCE_ROUTE))) {
+        const int numHops = option->getBytes(0);
+        for (int i = 0; i + 1 < numHops; i++) {
+            if (getSourceRouteHop(option, i) == nodeId) {
+                const int interfaceId = configurator->getNeighbourInterfaceId(nodeId, getSourceRouteHop(option, i + 1));
+                if (interfaceId > 0 && isInterfaceUp(interfaceId))
+                    return interfaceId;
+                break;
+            }
+        }
+    }
+
+    // Ingress, the last hop of a path that was too long for the header, or a node
+    // whose listed next hop is no longer reachable (a ground link changed or failed
+    // since ingress): compute the path from here
+    // The path is computed once per egress node and epoch and shared by all flows towards it
+    if (egressNode >= (int)sourceRoutes.size())
+        sourceRoutes.resize(egressNode + 1);
+    SourceRouteEntry& entry = sourceRoutes[egressNode];
+    const uint64_t epoch = configurator->getForwardingEpoch();
+    if (entry.epoch != epoch) {
+        entry.epoch = epoch;
+        if (!configurator->getSourceRoute(nodeId, egressNode, entry.path))
+            entry.path.clear();
+        numSourceRoutes++;
+    }
+    if (entry.path.empty())
+        return 0;
+    insertSourceRoute(packet, entry.path);
+    return configurator->getNeighbourInterfaceId(nodeId, entry.path.front());
+}
+
+void LeoIpv4::insertSourceRoute(Packet *packet, const std::vector<int>& path)
+{
+    auto header = packet->removeAtFront<Ipv4Header>();
+    const TlvOptionBase *oldOption = header->findOptionByType(IPOPTION_SOURCE_ROUTE);
+    const B oldOptionLength = oldOption != nullptr ? B(oldOption->getLength()) : B(0);
+    if (oldOption != nullptr)
+        header->getOptionsForUpdate().deleteOptionByType(IPOPTION_SOURCE_ROUTE);
+    B optionsLength = header->getHeaderLength() - IPv4_MIN_HEADER_LENGTH - oldOptionLength;
+
+    // As many hops as fit into the options, padded to a multiple of 4 bytes;
+    // the last listed node continues with a new list
+    const int numHops = std::min<int>(path.size(), (IPV4_MAX_OPTIONS_LENGTH - optionsLength - B(3)).get() / 2);
+    if (numHops > 0) {
+        auto option = new Ipv4OptionUnknown();
+        const int length = (3 + 2 * numHops + 3) & ~3;
+        option->setType(IPOPTION_SOURCE_ROUTE);
+        option->setLength(length);
+        option->setBytesArraySize(length - 2);
+        option->setBytes(0, numHops);
+        for (int i = 0; i < numHops; i++) {
+            option->setBytes(1 + 2 * i, path[i] >> 8);
+            option->setBytes(2 + 2 * i, path[i] & 0xff);
+        }
+        for (int i = 1 + 2 * numHops; i < length - 2; i++)
+            option->setBytes(i, 0);
+        header->addOption(option);
+        optionsLength += B(length);
+    }
+    const B headerLengthChange = IPv4_MIN_HEADER_LENGTH + optionsLength - header->getHeaderLength();
+    header->setHeaderLength(IPv4_MIN_HEADER_LENGTH + optionsLength);
+    header->setChunkLength(header->getHeaderLength());
+    header->setTotalLengthField(header->getTotalLengthField() + headerLengthChange);
+    packet->insertAtFront(header);
+}
+
+uint32_t LeoIpv4::computeFlowHash(Packet *packet, const Ipv4Header *ipv4Header) const
+{
+    uint64_t ports = ipv4Header->getProtocolId();
+    if (ipv4Header->getFragmentOffset() == 0) {
+        const b transportOffset = ipv4Header->getChunkLength();
+        if (ipv4Header->getProtocolId() == IP_PROT_TCP && packet->getDataLength() >= transportOffset + tcp::TCP_MIN_HEADER_LENGTH) {
+            const auto& tcpHeader = packet->peekDataAt<tcp::TcpHeader>(transportOffset);
+            ports |= ((uint64_t)tcpHeader->getSrcPort() << 16 | tcpHeader->getDestPort()) << 8;
+        }
+        else if (ipv4Header->getProtocolId() == IP_PROT_UDP && packet->getDataLength() >= transportOffset + UDP_HEADER_LENGTH) {
+            const auto& udpHeader = packet->peekDataAt<UdpHeader>(transportOffset);
+            ports |= ((uint64_t)udpHeader->getSrcPort() << 16 | udpHeader->getDestPort()) << 8;
+        }
+    }
+    const uint64_t addresses = (uint64_t)ipv4Header->getSrcAddress().getInt() << 32 | ipv4Header->getDestAddress().getInt();
+    return mixFlowKey(addresses ^ mixFlowKey(ports));
+}
+
 void LeoIpv4::stop()
 {
     Ipv4::stop();
-    nextHops.clear();
-    std::fill(primaryNextHopInterfaces.begin(), primaryNextHopInterfaces.end(), 0);
+    forwardingTable.clear();
+    previousForwardingTable.clear();
+    flowCache.assign(flowCache.size(), FlowCacheEntry());
+    flowlets.assign(flowlets.size(), FlowletEntry());
+    sourceRoutes.clear();
 }
 }
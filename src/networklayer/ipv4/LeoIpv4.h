@@ -19,9 +19,9 @@
 #include <inet/networklayer/ipv4/Ipv4.h>
 #include <inet/networklayer/common/NextHopAddressTag_m.h>
 #include <inet/linklayer/common/InterfaceTag_m.h>
+#include <inet/networklayer/ipv4/Ipv4Header_m.h>
 
-#include <unordered_map>
-#include <vector>
+#include "LeoForwardingTable.h"
 
 namespace inet {
 
@@ -29,18 +29,70 @@ class LeoIpv4NetworkConfigurator;
 
 class INET_API LeoIpv4 : public Ipv4{
 protected:
+    enum ForwardingMode { PRIMARY, ECMP, FLOWLET };
+
+    // Direct-mapped cache of forwarding decisions, only valid for the forwarding epoch it was filled in
+    struct FlowCacheEntry {
+        uint32_t destination = 0;
+        uint32_t flowHash = 0;
+        int interfaceId = 0;
+        uint64_t epoch = 0;
+    };
+
+    // Next hop of a flow in flowlet mode, kept while packets follow each other closer than flowletTimeout
+    struct FlowletEntry {
+        uint32_t flowHash = 0;
+        int interfaceId = 0;
+        uint64_t epoch = 0;
+        simtime_t lastSeen;
+    };
+
+    // Path from this node to an egress node, only valid for the forwarding epoch it was computed in
+    struct SourceRouteEntry {
+        uint64_t epoch = 0;
+        std::vector<int> path; // empty if the egress node was unreachable
+    };
+
     virtual void initialize(int stage) override;
+    virtual void finish() override;
     virtual void routeUnicastPacket(Packet *packet) override;
+    virtual int resolveOutputInterface(uint32_t destination, uint32_t flowHash, const LeoForwardingTable& table);
+    virtual int findLoopFreeAlternate(const LeoForwardingTable& table, int destinationNode);
+    virtual bool admitRoutingEpoch(Packet *packet);
+    virtual int routeBySourceRoute(Packet *packet, uint32_t destination);
+    virtual void insertSourceRoute(Packet *packet, const std::vector<int>& path);
+    bool isInterfaceUp(int interfaceId) const
+    {
+        const NetworkInterface *networkInterface = ift->getInterfaceById(interfaceId);
+        return networkInterface != nullptr && networkInterface->isUp();
+    }
+    virtual uint32_t computeFlowHash(Packet *packet, const Ipv4Header *ipv4Header) const;
     virtual void stop() override;
     int nodeId;
-    std::unordered_map<uint32_t,uint32_t> nextHops;   //Destination Address (int format) -> Interface ID
-    std::vector<int> primaryNextHopInterfaces;
-    std::unordered_map<int, std::unordered_map<int, int>> kNextHops;
+    LeoForwardingTable forwardingTable; // destination node ID -> interface ID, for each of the k next hops
+    LeoForwardingTable previousForwardingTable; // tables of the previous routing epoch, for packets admitted under it
+    long numPreviousEpochPackets = 0;
+    long numMovedPreviousEpochHops = 0; // previous epoch next hops whose interface led elsewhere by then
+    std::vector<SourceRouteEntry> sourceRoutes; // indexed by egress node
+    long numSourceRoutes = 0;
+    std::vector<FlowCacheEntry> flowCache; // destination address -> interface ID
+    long flowCacheHits = 0;
+    long flowCacheMisses = 0;
+
+    ForwardingMode forwardingMode = PRIMARY;
+    simtime_t flowletTimeout;
+    std::vector<FlowletEntry> flowlets; // indexed by flow hash
+    long numFlowlets = 0;
+
+    bool fastReroute = true;
+    long numFastReroutes = 0;
 public:
     void setNodeId(int id);
-    void addKNextHop(int k, int destinationNode, int nextInterfaceID);
-    void addNextHop(uint32_t destinationAddr, uint32_t nextInterfaceID);
+    void addKNextHop(int k, int destinationNode, int nextInterfaceID, bool equalCost = false);
     void clearNextHops();
+    LeoForwardingTable& getForwardingTable() { return forwardingTable; }
+    const LeoForwardingTable& getPreviousForwardingTable() const { return previousForwardingTable; }
+    void rotateForwardingTables(uint16_t *entries);
     LeoIpv4();
     virtual ~LeoIpv4();
 
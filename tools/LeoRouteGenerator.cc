@@ -0,0 +1,419 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+// Offline route generator. Propagates the orbits of a Walker constellation,
+// builds the topology of every routing interval and writes the route archive
+// that LeoIpv4NetworkConfigurator loads with loadFiles = true, without running
+// a simulation. The topology follows LeoChannelConstructor and
+// LeoIpv4NetworkConfigurator::establishInitialISLs(). Routes are shortest paths
+// by propagation delay; with more than one next hop they are ranked on the
+// destination trees exactly as the configurator does. idMap.txt is written in
+// the configurator's format.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "libnorad/cEci.h"
+#include "libnorad/cOrbitA.h"
+#include "libnorad/cSite.h"
+#include "libnorad/globals.h"
+#include "networklayer/configurator/ipv4/LeoRouteArchive.h"
+#include "networklayer/configurator/ipv4/LeoRouteFile.h"
+#include "networklayer/configurator/ipv4/LeoRoutingGraph.h"
+#include "networklayer/configurator/ipv4/LeoRoutingThreads.h"
+
+using namespace inet;
+
+namespace {
+
+const double SPEED_OF_LIGHT = 299792458.0;
+
+// Simulation start used by SatelliteMobility::initialize(), 8:20PM 22/04/2021 UTC
+const std::time_t SIMULATION_START = 1619119189;
+
+// Conversion used by the ini files for NoradModule.inclination
+const double RADIANS_PER_DEGREE = 0.0174533;
+
+struct Options
+{
+    int numOfSats = 0;
+    int numOfPlanes = 0;
+    int satsPerPlane = 0;
+    double altitude = 550;        // km
+    double inclination = 53;      // degrees
+    double eccentricity = 0.000001;
+    int phaseOffset = 0;
+    double elevationAngle = 25;   // degrees
+    bool interSatelliteLinks = true;
+    double updateInterval = 0.1;  // s
+    double duration = 1;          // s
+    int simtimeScale = -12;
+    std::string groundStationFile;
+    std::string outputDirectory = ".";
+    int numThreads = 0;
+    int compressionLevel = 0;
+    int numOfNextHops = 1;
+    bool edgeDisjointKPaths = false;
+    double ecmpCostSlack = 0.05;
+    int firstModuleId = 4;
+    int keyframeSpacing = LEO_ROUTE_KEYFRAME_SPACING;
+};
+
+struct GroundStation
+{
+    double latitude;
+    double longitude;
+};
+
+struct SatellitePosition
+{
+    cEci eci;
+    double latitude;  // degrees
+    double longitude; // degrees
+    double altitude;  // km
+};
+
+void printUsage(const char *program)
+{
+    std::cerr << "Usage: " << program << " --sats N --planes P --sats-per-plane S --ground-stations FILE [options]\n"
+              << "  --altitude KM            orbit altitude (550)\n"
+              << "  --inclination DEG        orbit inclination (53)\n"
+              << "  --eccentricity E         orbit eccentricity (0.000001)\n"
+              << "  --phase-offset N         NoradA phaseOffset (0)\n"
+              << "  --elevation-angle DEG    minimum elevation of a ground link (25)\n"
+              << "  --bent-pipe              no inter-satellite links\n"
+              << "  --update-interval S      routing interval, mobility.updateInterval (0.1)\n"
+              << "  --duration S             sim-time-limit (1)\n"
+              << "  --simtime-scale EXP      simtime-resolution exponent of the simulation (-12)\n"
+              << "  --output DIR             folder the configuration folder is created in, configLocation (.)\n"
+              << "  --threads N              worker threads, 0 = one per hardware core (0)\n"
+              << "  --compression LEVEL      zlib level of the archive, 0 = uncompressed (0)\n"
+              << "  --keyframe-spacing N     routeKeyframeSpacing, intervals per full route file (64)\n"
+              << "  --next-hops K            numOfNextHops of the configurator (1)\n"
+              << "  --edge-disjoint          edgeDisjointKPaths of the configurator, needs --next-hops 2\n"
+              << "  --ecmp-cost-slack S      ecmpCostSlack of the configurator (0.05)\n"
+              << "  --first-module-id ID     module ID of satellite[0] for idMap.txt, the ground stations\n"
+              << "                           follow the satellites (4, as in SatSGP4)\n"
+              << "FILE lists one ground station per line as \"latitude longitude\" in degrees,\n"
+              << "in groundStation[] order; text after the longitude and lines starting with # are ignored.\n";
+}
+
+bool parseOptions(int argc, char **argv, Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        const std::string name = argv[i];
+        if (name == "--bent-pipe") {
+            options.interSatelliteLinks = false;
+            continue;
+        }
+        if (name == "--edge-disjoint") {
+            options.edgeDisjointKPaths = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            return false;
+        const char *value = argv[++i];
+        if (name == "--sats")
+            options.numOfSats = std::atoi(value);
+        else if (name == "--planes")
+            options.numOfPlanes = std::atoi(value);
+        else if (name == "--sats-per-plane")
+            options.satsPerPlane = std::atoi(value);
+        else if (name == "--altitude")
+            options.altitude = std::atof(value);
+        else if (name == "--inclination")
+            options.inclination = std::atof(value);
+        else if (name == "--eccentricity")
+            options.eccentricity = std::atof(value);
+        else if (name == "--phase-offset")
+            options.phaseOffset = std::atoi(value);
+        else if (name == "--elevation-angle")
+            options.elevationAngle = std::atof(value);
+        else if (name == "--update-interval")
+            options.updateInterval = std::atof(value);
+        else if (name == "--duration")
+            options.duration = std::atof(value);
+        else if (name == "--simtime-scale")
+            options.simtimeScale = std::atoi(value);
+        else if (name == "--ground-stations")
+            options.groundStationFile = value;
+        else if (name == "--output")
+            options.outputDirectory = value;
+        else if (name == "--threads")
+            options.numThreads = std::atoi(value);
+        else if (name == "--compression")
+            options.compressionLevel = std::atoi(value);
+        else if (name == "--keyframe-spacing")
+            options.keyframeSpacing = std::atoi(value);
+        else if (name == "--next-hops")
+            options.numOfNextHops = std::atoi(value);
+        else if (name == "--ecmp-cost-slack")
+            options.ecmpCostSlack = std::atof(value);
+        else if (name == "--first-module-id")
+            options.firstModuleId = std::atoi(value);
+        else
+            return false;
+    }
+    return options.numOfSats > 0 && options.numOfPlanes > 0 && options.satsPerPlane > 0 && options.updateInterval > 0
+           && options.simtimeScale <= 0 && options.simtimeScale >= -18 && options.compressionLevel >= 0 && options.compressionLevel <= 9
+           && options.keyframeSpacing >= 1
+           && options.numOfNextHops >= 1 && options.numOfNextHops <= 128 && (!options.edgeDisjointKPaths || options.numOfNextHops == 2);
+}
+
+bool readGroundStations(const std::string& fileName, std::vector<GroundStation>& groundStations)
+{
+    std::ifstream file(fileName);
+    if (!file.is_open())
+        return false;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        GroundStation groundStation;
+        if (line.empty() || line[0] == '#' || !(fields >> groundStation.latitude))
+            continue;
+        if (!(fields >> groundStation.longitude))
+            return false;
+        groundStations.push_back(groundStation);
+    }
+    return true;
+}
+
+// Same formatting as the configuration folder name in LeoIpv4NetworkConfigurator::initialize()
+std::string formatNumber(double value)
+{
+    std::string text = std::to_string(value);
+    text.erase(text.find_last_not_of('0') + 1);
+    if (!text.empty() && text.back() == '.')
+        text.pop_back();
+    return text;
+}
+
+std::string getConfigurationName(const Options& options, int numOfGS)
+{
+    return std::to_string(options.numOfSats) + "_" + formatNumber(options.altitude) + "_" + std::to_string(options.numOfPlanes) + "_"
+           + std::to_string(options.satsPerPlane) + "_" + formatNumber(options.inclination) + "_" + std::to_string(numOfGS)
+           + (options.interSatelliteLinks ? "_ISL" : "_BP");
+}
+
+// Same format as LeoIpv4NetworkConfigurator::writeModuleIDMappingsToFile(). Module IDs
+// are assigned in creation order, so the satellite and ground station vectors get
+// consecutive IDs starting at the first satellite.
+bool writeModuleIDMappings(const std::string& fileName, const Options& options, int numOfGS)
+{
+    std::ofstream file(fileName);
+    for (int nodeNum = 0; nodeNum < options.numOfSats + numOfGS; nodeNum++) {
+        if (nodeNum < options.numOfSats)
+            file << "satellite[" << nodeNum << "]";
+        else
+            file << "groundStation[" << nodeNum - options.numOfSats << "]";
+        file << " = " << options.firstModuleId + nodeNum << "\n";
+    }
+    return file.good();
+}
+
+// Inter-satellite links in the order of LeoIpv4NetworkConfigurator::establishInitialISLs()
+void collectInterSatelliteLinks(const Options& options, std::vector<int>& islEndpoints)
+{
+    const int numOfSats = options.numOfSats;
+    const int satPerPlane = options.satsPerPlane;
+    const int numOfPlanes = (int)std::ceil(((double)numOfSats / ((double)options.numOfPlanes * (double)satPerPlane)) * (double)options.numOfPlanes);
+    for (int planeNum = 0; planeNum < numOfPlanes; planeNum++) {
+        const int numOfSatsInPlane = std::min(planeNum * satPerPlane + satPerPlane, numOfSats);
+        for (int satNum = planeNum * satPerPlane; satNum < numOfSatsInPlane; satNum++) {
+            int destSatNumA = (satNum + 1) % (satPerPlane * (planeNum + 1));
+            if (destSatNumA == 0)
+                destSatNumA = planeNum * satPerPlane;
+            if (destSatNumA < numOfSats) {
+                islEndpoints.push_back(satNum);
+                islEndpoints.push_back(destSatNumA);
+            }
+            const int destSatNumB = satNum + satPerPlane;
+            if (destSatNumB < numOfSats) {
+                islEndpoints.push_back(satNum);
+                islEndpoints.push_back(destSatNumB);
+            }
+        }
+    }
+}
+
+// Straight line delay in ms from the satellite to a point, as INorad::getDistance()
+double getDelay(const SatellitePosition& satellite, double latitude, double longitude, double altitude)
+{
+    cSite site(latitude, longitude, altitude);
+    return site.getLookAngle(satellite.eci).m_Range * 1000.0 / SPEED_OF_LIGHT * 1000.0;
+}
+
+double getElevation(const SatellitePosition& satellite, const GroundStation& groundStation)
+{
+    cSite site(groundStation.latitude, groundStation.longitude, 0);
+    return rad2deg(site.getLookAngle(satellite.eci).m_El);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options) || options.groundStationFile.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    std::vector<GroundStation> groundStations;
+    if (!readGroundStations(options.groundStationFile, groundStations)) {
+        std::cerr << "Cannot read ground stations from " << options.groundStationFile << std::endl;
+        return 1;
+    }
+
+    const int numOfSats = options.numOfSats;
+    const int numOfGS = groundStations.size();
+    const int numNodes = numOfSats + numOfGS;
+    const int numThreads = resolveRoutingThreadCount(options.numThreads, numNodes);
+
+    // Orbits as set up by NoradA::initializeMobility()
+    std::tm *startTime = std::gmtime(&SIMULATION_START);
+    const cJulian startJulian(startTime->tm_year + 1900, startTime->tm_mon + 1, startTime->tm_mday, startTime->tm_hour, startTime->tm_min, 0);
+    std::vector<std::unique_ptr<cOrbitA>> orbits;
+    std::vector<double> gaps;
+    for (int satNum = 0; satNum < numOfSats; satNum++) {
+        orbits.emplace_back(new cOrbitA("sat", 0, 0, options.altitude, options.eccentricity, options.inclination * RADIANS_PER_DEGREE, 0, 0, 0,
+                                        options.phaseOffset, satNum, options.numOfPlanes, options.satsPerPlane));
+        gaps.push_back(orbits.back()->TPlusEpoch(startJulian));
+    }
+
+    std::vector<int> islEndpoints;
+    if (options.interSatelliteLinks)
+        collectInterSatelliteLinks(options, islEndpoints);
+
+    const std::string configurationName = getConfigurationName(options, numOfGS);
+    const std::filesystem::path folder = std::filesystem::path(options.outputDirectory) / configurationName;
+    std::filesystem::create_directories(folder);
+    const std::string idMapName = (folder / "idMap.txt").string();
+    if (!writeModuleIDMappings(idMapName, options, numOfGS)) {
+        std::cerr << "Cannot write " << idMapName << std::endl;
+        return 1;
+    }
+    const std::string archiveName = (folder / LEO_ROUTE_ARCHIVE_NAME).string();
+    LeoRouteArchiveWriter writer;
+    if (!writer.open(archiveName, options.compressionLevel, options.keyframeSpacing)) {
+        std::cerr << "Cannot create route archive " << archiveName << std::endl;
+        return 1;
+    }
+
+    // Interval times of LeoChannelConstructor: 0, then one microsecond after
+    // every update interval
+    int64_t ticksPerSecond = 1;
+    for (int exponent = options.simtimeScale; exponent < 0; exponent++)
+        ticksPerSecond *= 10;
+    const int64_t intervalTicks = std::llround(options.updateInterval * ticksPerSecond);
+    const int64_t durationTicks = std::llround(options.duration * ticksPerSecond);
+    const int64_t startOffsetTicks = ticksPerSecond / 1000000;
+
+    std::vector<SatellitePosition> positions(numOfSats);
+    std::vector<int> edgeEndpoints;
+    std::vector<double> edgeWeights;
+    LeoRoutingGraph graph;
+    LeoRouteState state;
+    const int k = options.numOfNextHops;
+    state.reset(numNodes, k, numNodes);
+    std::vector<LeoShortestPathTree> trees(numThreads);
+    std::vector<LeoDijkstraScratch> scratch(numThreads);
+    std::vector<std::vector<int>> firstHops(numThreads);
+    std::vector<std::vector<int>> nextHops(numThreads);
+    std::vector<std::vector<char>> equalCost(numThreads);
+    int numIntervals = 0;
+    for (int64_t intervalNum = 0;; intervalNum++) {
+        const int64_t interval = intervalNum == 0 ? 0 : intervalNum * intervalTicks + startOffsetTicks;
+        if (interval > durationTicks)
+            break;
+        const double time = (double)interval / ticksPerSecond;
+
+        parallelForEach(0, numOfSats, numThreads, [&](int satNum, int) {
+            SatellitePosition& position = positions[satNum];
+            orbits[satNum]->getPosition((gaps[satNum] + time) / 60, &position.eci);
+            const cCoordGeo geoCoord = position.eci.toGeo();
+            position.latitude = rad2deg(geoCoord.m_Lat);
+            position.longitude = rad2deg(geoCoord.m_Lon);
+            position.altitude = geoCoord.m_Alt;
+        });
+
+        // ISLs first, then the ground links of every reachable satellite
+        edgeEndpoints = islEndpoints;
+        edgeWeights.clear();
+        for (size_t i = 0; i < islEndpoints.size(); i += 2) {
+            const SatellitePosition& destination = positions[islEndpoints[i + 1]];
+            edgeWeights.push_back(getDelay(positions[islEndpoints[i]], destination.latitude, destination.longitude, destination.altitude));
+        }
+        for (int gsNum = 0; gsNum < numOfGS; gsNum++) {
+            const GroundStation& groundStation = groundStations[gsNum];
+            for (int satNum = 0; satNum < numOfSats; satNum++) {
+                if (getElevation(positions[satNum], groundStation) <= options.elevationAngle)
+                    continue;
+                edgeEndpoints.push_back(numOfSats + gsNum);
+                edgeEndpoints.push_back(satNum);
+                edgeWeights.push_back(getDelay(positions[satNum], groundStation.latitude, groundStation.longitude, 0));
+            }
+        }
+        graph.build(numNodes, edgeEndpoints, edgeWeights);
+
+        state.clear();
+        if (k == 1) {
+            // Every source fills its own row of the state
+            parallelForEach(0, numNodes, numThreads, [&](int sourceNodeNum, int worker) {
+                computeShortestPathTree(graph, sourceNodeNum, trees[worker], scratch[worker]);
+                std::vector<int>& firstHop = firstHops[worker];
+                computeFirstHops(trees[worker], sourceNodeNum, firstHop);
+                for (int destinationNodeNum = 0; destinationNodeNum < numNodes; destinationNodeNum++) {
+                    if (firstHop[destinationNodeNum] >= 0)
+                        state.set(sourceNodeNum, 0, destinationNodeNum, firstHop[destinationNodeNum]);
+                }
+            });
+        }
+        else {
+            // As LeoIpv4NetworkConfigurator::computeDestinationTrees(), every
+            // destination fills its own column of the state
+            parallelForEach(0, numNodes, numThreads, [&](int destinationNodeNum, int worker) {
+                computeShortestPathTree(graph, destinationNodeNum, trees[worker], scratch[worker]);
+                computeDestinationNextHops(graph, trees[worker], destinationNodeNum, k, options.edgeDisjointKPaths, options.ecmpCostSlack,
+                                           scratch[worker], nextHops[worker], equalCost[worker]);
+                for (int nodeNum = 0; nodeNum < numNodes; nodeNum++) {
+                    for (int rank = 0; rank < k && nextHops[worker][nodeNum * k + rank] >= 0; rank++)
+                        state.set(nodeNum, rank, destinationNodeNum, nextHops[worker][nodeNum * k + rank]
+                                  | (equalCost[worker][nodeNum * k + rank] ? LeoRouteState::EQUAL_COST_FLAG : 0));
+                }
+            });
+        }
+        if (!writer.append(interval, state)) {
+            std::cerr << "Cannot write interval " << time << "s to " << archiveName << std::endl;
+            return 1;
+        }
+        numIntervals++;
+    }
+    if (!writer.close()) {
+        std::cerr << "Cannot write the index of " << archiveName << std::endl;
+        return 1;
+    }
+    std::cout << "Wrote " << numIntervals << " intervals of " << numOfSats << " satellites and " << numOfGS << " ground stations to " << archiveName << std::endl;
+    return 0;
+}